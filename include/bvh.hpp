@@ -1,8 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <new>
+#include <string>
 #include <vector>
 
 
@@ -13,6 +17,7 @@
 #include <glm/vec3.hpp>
 
 #include "object.hpp"
+#include "primitive_blocks.hpp"
 
 namespace raytracing {
 
@@ -23,11 +28,25 @@ struct AABB {
 
     void extend(const glm::vec3& p);
     void extend(const AABB& aabb);
-    void extend(const Object &obj);
+    void extend(const Geometry &obj);
     float S() const;
 };
 
-struct Node {
+// FNV-1a over 64-bit words, for the keys of the BVH cache.
+struct Hasher {
+    uint64_t value = 0xcbf29ce484222325ull;
+
+    void add(const void *data, size_t size);
+    template <typename T> void add(const T &x) { add(&x, sizeof(x)); }
+};
+
+struct PrimitiveRef {
+    AABB aabb;
+    glm::vec3 center;
+    int index;
+};
+
+struct BuildNode {
     AABB aabb;
     int left_child = -1;
     int right_child = -1;
@@ -36,17 +55,264 @@ struct Node {
     int split_axis = -1;
 };
 
+// Nodes are stored depth-first: the left child of an inner node is the next node, offset is the right child for
+// inner nodes and the first slot of BVH::references for leaves.
+struct Node {
+    AABB aabb;
+    int offset = -1;
+    uint32_t primitive_count : 30 = 0;
+    uint32_t split_axis : 2 = 0;
+
+    bool is_leaf() const { return primitive_count > 0; }
+};
+
+static_assert(sizeof(Node) == 32);
+
+static constexpr size_t cache_line_size = 64;
+
+template <typename T, size_t alignment> struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U> struct rebind {
+        using other = AlignedAllocator<U, alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, alignment> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(alignment))); }
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(alignment)); }
+
+    bool operator==(const AlignedAllocator &) const { return true; }
+};
+
+struct TraversalRay {
+    glm::vec3 pos;
+    glm::vec3 inv_dir;
+    int sign[3];
+
+    TraversalRay(const Ray &r);
+    bool intersect(const AABB &aabb, float max_distance, float &t_entry) const;
+};
+
+void intersect_primitives(const std::vector<Object> &primitives,
+                          const PrimitiveBlocks &blocks,
+                          int first,
+                          int count,
+                          const Ray &r,
+                          std::pair<OptInsc, const Object *> &nearest,
+                          float &max_distance);
+
+bool occluded_primitives(const PrimitiveBlocks &blocks, int first, int count, const Ray &r, float t_max);
+
+static constexpr int traversal_stack_size = 64;
+
+// Insertion sort of the n hit children of a wide node by decreasing entry distance, so that pushing them in order
+// leaves the nearest on top of the stack. n is at most 8, where this beats a general sort.
+inline void sort_far_to_near(int *hits, int n, const float *t_entry) {
+    for (int a = 1; a < n; ++a) {
+        int child = hits[a];
+        int b = a;
+        for (; b > 0 && t_entry[hits[b - 1]] < t_entry[child]; --b) {
+            hits[b] = hits[b - 1];
+        }
+        hits[b] = child;
+    }
+}
+
+template <typename Entry = std::pair<int, float>> struct TraversalStack {
+    Entry entries[traversal_stack_size];
+    std::vector<Entry> overflow;
+    int size = 0;
+
+    void push(const Entry &entry) {
+        if (size < traversal_stack_size) {
+            entries[size] = entry;
+        } else {
+            overflow.push_back(entry);
+        }
+        ++size;
+    }
+
+    void push(int i, float t) { push({i, t}); }
+
+    Entry pop() {
+        --size;
+        if (size < traversal_stack_size) {
+            return entries[size];
+        }
+        auto entry = overflow.back();
+        overflow.pop_back();
+        return entry;
+    }
+};
+
+enum BuildMethod { Sweep, Binned, Linear, Spatial };
+
 struct BVH {
-    std::vector<Node> nodes;
-    int root;
+    std::vector<Node, AlignedAllocator<Node, cache_line_size>> nodes;
+    std::vector<BuildNode> build_nodes;
+    PrimitiveBlocks blocks;
+    int root = -1;
+    BuildMethod method = BuildMethod::Binned;
+    int treelet_passes = 0;
+    float duplication_budget = 0.25f;
+    float built_sah_cost = 0.f;
+    float rebuild_threshold = 1.5f;
+    std::string cache_directory;
+    bool loaded_from_cache = false;
+    // leaf slots in tree order, each holding the index of a primitive; spatial splits can reference a primitive from
+    // several leaves
+    std::vector<int> references;
+    std::vector<int> primitive_ids;
+    int next_primitive_id = 0;
+    // Edits patch the nodes in place and leave them out of depth-first order until relayout(). Meanwhile parents holds
+    // the parent of every slot, free_nodes the slots they emptied and edit_cost the SAH cost before the division by the
+    // root area.
+    bool depth_first = true;
+    std::vector<int> parents;
+    std::vector<int> free_nodes;
+    double edit_cost = 0.0;
 
-    int build_node(std::vector<Object> &primitives, int first, int count);
-    void build(std::vector<Object> &primitives);
+    int build_node(std::vector<PrimitiveRef> &refs, int first, int count, std::atomic_int &node_count);
+    int build_node_binned(std::vector<PrimitiveRef> &refs, int first, int count, std::atomic_int &node_count);
+    void build_linear(std::vector<PrimitiveRef> &refs);
+    void build_spatial(std::vector<PrimitiveRef> &refs, const std::vector<Geometry> &primitives);
+    void build(std::vector<PrimitiveRef> &refs);
+    void build(const std::vector<Geometry> &primitives);
+    void flatten();
+    void relayout();
+    void begin_edit();
+    int allocate_nodes(int count);
+    void free_node(int i);
+    void set_aabb(int i, const AABB &aabb);
+    int set_children(int i, int a, int b);
+    void insert_leaf(const Node &leaf);
+    int rotate(int i);
+    void refit_upwards(int i, bool rotations);
+    void finish_edit(const std::vector<Geometry> &primitives, int first_changed);
+    std::vector<int> insert(std::vector<Geometry> &primitives, const std::vector<Geometry> &added);
+    void remove(std::vector<Geometry> &primitives, std::vector<Object> &objects, const std::vector<int> &ids);
+    void hash_settings(Hasher &hasher) const;
+    uint64_t geometry_hash(const std::vector<Geometry> &primitives) const;
+    std::string cache_path(uint64_t key) const;
+    bool load(const std::string &fp, uint64_t key, size_t primitive_count);
+    void save(const std::string &fp, uint64_t key) const;
+    void refit(const std::vector<Geometry> &primitives);
+    void refit_parallel(const std::vector<Geometry> &primitives);
+    void refit_subtree(const std::vector<Geometry> &primitives, int first, int end);
+    bool update(const std::vector<Geometry> &primitives);
+    std::vector<int> wide_children(int i, int width) const;
+    float sah_cost() const;
+    static float node_cost(const Node &node);
     void intersect(const std::vector<Object> &primitives,
                const Ray& r,
                std::pair<OptInsc, const Object *>& nearest,
-               float& max_distance,
-               int i = -2) const;
+               float& max_distance) const;
+    bool occluded(const Ray &r, float t_max) const;
+
+    template <typename Leaf>
+    void traverse(const Ray &r, float &max_distance, Leaf leaf) const;
+    template <typename Leaf>
+    bool traverse_any(const Ray &r, float t_max, Leaf leaf) const;
 };
 
+// Visits the leaves hit by the ray nearest first; leaf(first, count) may shrink max_distance.
+template <typename Leaf>
+void BVH::traverse(const Ray &r, float &max_distance, Leaf leaf) const {
+    if (root == -1) {
+        return;
+    }
+
+    TraversalRay ray(r);
+    float t_entry;
+    if (!ray.intersect(nodes[root].aabb, max_distance, t_entry)) {
+        return;
+    }
+
+    TraversalStack stack;
+    int i = root;
+    while (true) {
+        auto &node = nodes[i];
+        if (node.is_leaf()) {
+            leaf(node.offset, node.primitive_count);
+        } else {
+            int left = i + 1;
+            int right = node.offset;
+            float t_left, t_right;
+            bool hit_left = ray.intersect(nodes[left].aabb, max_distance, t_left);
+            bool hit_right = ray.intersect(nodes[right].aabb, max_distance, t_right);
+            if (hit_left && hit_right) {
+                if (t_left <= t_right) {
+                    stack.push(right, t_right);
+                    i = left;
+                } else {
+                    stack.push(left, t_left);
+                    i = right;
+                }
+                continue;
+            }
+            if (hit_left || hit_right) {
+                i = hit_left ? left : right;
+                continue;
+            }
+        }
+
+        i = -1;
+        while (stack.size > 0) {
+            auto [j, t] = stack.pop();
+            if (t < max_distance) {
+                i = j;
+                break;
+            }
+        }
+        if (i == -1) {
+            return;
+        }
+    }
+}
+
+// Visits the leaves hit by the ray in any order until leaf(first, count) reports a hit.
+template <typename Leaf>
+bool BVH::traverse_any(const Ray &r, float t_max, Leaf leaf) const {
+    if (root == -1) {
+        return false;
+    }
+
+    TraversalRay ray(r);
+    float t_entry;
+    if (!ray.intersect(nodes[root].aabb, t_max, t_entry)) {
+        return false;
+    }
+
+    TraversalStack stack;
+    int i = root;
+    while (true) {
+        auto &node = nodes[i];
+        if (node.is_leaf()) {
+            if (leaf(node.offset, node.primitive_count)) {
+                return true;
+            }
+        } else {
+            int left = i + 1;
+            int right = node.offset;
+            float t_left, t_right;
+            bool hit_left = ray.intersect(nodes[left].aabb, t_max, t_left);
+            bool hit_right = ray.intersect(nodes[right].aabb, t_max, t_right);
+            if (hit_left && hit_right) {
+                stack.push(right, t_right);
+            }
+            if (hit_left || hit_right) {
+                i = hit_left ? left : right;
+                continue;
+            }
+        }
+
+        if (stack.size == 0) {
+            return false;
+        }
+        i = stack.pop().first;
+    }
+}
+
 } // namespace raytracing
\ No newline at end of file
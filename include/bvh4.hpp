@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "bvh.hpp"
+
+namespace raytracing {
+
+struct alignas(16) Node4 {
+    // min x, min y, min z, max x, max y, max z of the four children
+    float bounds[6][4];
+    int children[4];
+    int primitive_counts[4];
+};
+
+struct BVH4 {
+    std::vector<Node4> nodes;
+    int root = -1;
+    const PrimitiveBlocks *blocks = nullptr;
+
+    int collapse_node(const BVH &bvh, int i);
+    void build(const BVH &bvh);
+    void intersect(const std::vector<Object> &primitives,
+                   const Ray &r,
+                   std::pair<OptInsc, const Object *> &nearest,
+                   float &max_distance) const;
+    bool occluded(const Ray &r, float t_max) const;
+};
+
+} // namespace raytracing
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh.hpp"
+
+namespace raytracing {
+
+// A node spans two adjacent cache lines: the quantized child boxes fill the first, which every visit reads, and the
+// child references the second, which is read for the children that are hit. Both lines share a 128 byte block, which
+// the adjacent-line prefetcher fetches together.
+struct alignas(128) Node8 {
+    glm::vec3 origin;
+    int8_t exponents[3];
+    uint8_t child_mask;
+    // lower x, y, z and upper x, y, z bounds of the eight children in steps of 2^exponent from origin
+    uint8_t bounds[6][8];
+    int children[8];
+    int primitive_counts[8];
+};
+
+static_assert(sizeof(Node8) == 128);
+
+struct BVH8 {
+    std::vector<Node8> nodes;
+    int root = -1;
+    const PrimitiveBlocks *blocks = nullptr;
+    bool use_avx2 = false;
+
+    int collapse_node(const BVH &bvh, int i);
+    void build(const BVH &bvh);
+    size_t memory_footprint() const;
+    void intersect(const std::vector<Object> &primitives,
+                   const Ray &r,
+                   std::pair<OptInsc, const Object *> &nearest,
+                   float &max_distance) const;
+    bool occluded(const Ray &r, float t_max) const;
+};
+
+} // namespace raytracing
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "scene.hpp"
+
+namespace raytracing {
+
+// Shape and cost of a built BVH. depth_histogram counts the leaves at each depth, with the root at depth 0, and
+// leaf_size_histogram counts the leaves holding each number of primitives.
+struct BVHStatistics {
+    std::string name;
+    std::string method;
+    int node_count = 0;
+    int inner_count = 0;
+    int leaf_count = 0;
+    int primitive_count = 0;
+    int unique_primitive_count = 0;
+    int max_depth = 0;
+    float average_leaf_depth = 0.f;
+    std::vector<int> depth_histogram;
+    std::vector<int> leaf_size_histogram;
+    float sah_cost = 0.f;
+    // Surface area of the intersection of sibling boxes, summed over inner nodes relative to the root area, and
+    // averaged relative to the parent area.
+    float overlap = 0.f;
+    float average_child_overlap = 0.f;
+    size_t node_bytes = 0;
+    size_t primitive_bytes = 0;
+    size_t object_bytes = 0;
+    size_t reference_bytes = 0;
+    size_t block_bytes = 0;
+};
+
+BVHStatistics collect_statistics(const BVH &bvh);
+BVHStatistics collect_statistics(const BVH &bvh, const std::vector<Geometry> &primitives, const std::vector<Object> &objects);
+// One entry for the scene BVH, and with instances one for the TLAS and one per group and mesh BVH.
+std::vector<BVHStatistics> collect_statistics(const Scene &scene);
+void write_json(std::ostream &out, const std::vector<BVHStatistics> &statistics);
+
+} // namespace raytracing
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "bvh.hpp"
+#include "object.hpp"
+
+namespace raytracing {
+
+// Uniform grid over the primitive bounds, traversed with a 3D-DDA. Each cell lists the primitives whose bounds
+// overlap it, stored compactly as offsets into one reference array. The references are tested against a copy of the
+// primitives' intersection data, in the original primitive order.
+struct Grid {
+    AABB bounds;
+    glm::ivec3 resolution = {0, 0, 0};
+    glm::vec3 cell_size = {0.f, 0.f, 0.f};
+    std::vector<int> cells;
+    std::vector<int> references;
+    PrimitiveBlocks blocks;
+
+    void build(const std::vector<Geometry> &primitives);
+    size_t memory_footprint() const;
+    void intersect(const std::vector<Object> &primitives,
+                   const Ray &r,
+                   std::pair<OptInsc, const Object *> &nearest,
+                   float &max_distance) const;
+    bool occluded(const Ray &r, float t_max) const;
+
+    template <typename Cell>
+    void traverse(const Ray &r, float &max_distance, Cell cell) const;
+};
+
+// Whether the primitive sizes are uniform enough for a grid to beat the BVH.
+bool prefers_grid(const std::vector<Geometry> &primitives);
+
+// Visits the cells pierced by the ray in order until one ends beyond max_distance; cell(first, end) returns true to stop.
+template <typename Cell>
+void Grid::traverse(const Ray &r, float &max_distance, Cell cell) const {
+    if (cells.empty()) {
+        return;
+    }
+
+    TraversalRay ray(r);
+    float t_entry;
+    if (!ray.intersect(bounds, max_distance, t_entry)) {
+        return;
+    }
+    t_entry = std::max(t_entry, 0.f);
+
+    glm::vec3 p = r.pos + r.dir * t_entry;
+    int index[3], step[3], end[3];
+    float t_next[3], t_delta[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        index[axis] = std::clamp(static_cast<int>((p[axis] - bounds.min[axis]) / cell_size[axis]), 0, resolution[axis] - 1);
+        if (r.dir[axis] == 0.f) {
+            step[axis] = 0;
+            end[axis] = -1;
+            t_next[axis] = std::numeric_limits<float>::infinity();
+            t_delta[axis] = 0.f;
+            continue;
+        }
+        step[axis] = r.dir[axis] > 0.f ? 1 : -1;
+        end[axis] = r.dir[axis] > 0.f ? resolution[axis] : -1;
+        float boundary = bounds.min[axis] + (index[axis] + (step[axis] > 0)) * cell_size[axis];
+        t_next[axis] = (boundary - r.pos[axis]) * ray.inv_dir[axis];
+        t_delta[axis] = cell_size[axis] * std::abs(ray.inv_dir[axis]);
+    }
+
+    while (true) {
+        int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+        int c = (index[2] * resolution[1] + index[1]) * resolution[0] + index[0];
+        if (cell(cells[c], cells[c + 1]) || t_next[axis] >= max_distance) {
+            return;
+        }
+        index[axis] += step[axis];
+        if (index[axis] == end[axis]) {
+            return;
+        }
+        t_next[axis] += t_delta[axis];
+    }
+}
+
+} // namespace raytracing
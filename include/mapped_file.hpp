@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+// Read-only view of a whole file, memory-mapped where the platform allows it.
+struct MappedFile {
+    MappedFile(const std::string &fp);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return begin; }
+    size_t size() const { return length; }
+    bool valid() const { return begin != nullptr; }
+
+private:
+    const char *begin = nullptr;
+    size_t length = 0;
+    std::vector<char> buffer;
+};
+
+} // namespace raytracing
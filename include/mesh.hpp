@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "mapped_file.hpp"
+#include "object.hpp"
+
+namespace raytracing {
+
+// Positions stored every stride bytes, possibly unaligned.
+struct VertexView {
+    const char *data;
+    size_t stride;
+    size_t count;
+
+    glm::vec3 operator[](size_t i) const {
+        glm::vec3 p;
+        std::memcpy(&p, data + i * stride, sizeof(p));
+        return p;
+    }
+};
+
+// Indexed triangle mesh: triangles index a shared vertex buffer and optional per-vertex normals, which are
+// interpolated for shading. The BVH references triangles by their slot in the index buffer, which build() reorders to
+// the leaf order. The mesh's POSITION and ROTATION live in transform, its shading attributes in material.
+// Positions are either owned in vertices or, when mapping is set, read in place from the vertex records of a
+// memory-mapped file; positions() gives the same view of both.
+struct Mesh {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::uvec3> triangles;
+    Geometry transform;
+    Object material;
+    BVH bvh;
+    std::shared_ptr<const MappedFile> mapping;
+    VertexView mapped_vertices = {nullptr, 0, 0};
+
+    VertexView positions() const;
+    void bake_transform();
+    uint64_t geometry_hash() const;
+    bool reorder_triangles();
+    void build(const BVH &settings);
+    size_t memory_footprint() const;
+    glm::vec3 normal(int i, float u, float v, const glm::vec3 &dir) const;
+    void intersect(const Ray &r, std::pair<OptInsc, const Object *> &nearest, float &max_distance) const;
+    bool occluded(const Ray &r, float t_max) const;
+};
+
+void load_obj(const std::string &fp, Mesh &mesh);
+void load_ply(const std::string &fp, Mesh &mesh);
+
+} // namespace raytracing
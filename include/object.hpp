@@ -16,14 +16,13 @@ enum Material { Diffuse, Metallic, Dielectric };
 
 enum Shape { Plane, Ellipsoid, Box, Triangle };
 
-struct Object {
+// Shape and placement of a primitive. The accelerators copy what their tests need into their primitive blocks, so the
+// geometry is read when they are built, refitted or edited.
+struct Geometry {
     glm::vec3 position = {0.f, 0.f, 0.f};
     glm::vec3 center = {0.f, 0.f, 0.f};
     glm::quat rotation = {1.f, 0.f, 0.f, 0.f};
     glm::quat inv_rotation = {1.f, 0.f, 0.f, 0.f};
-    glm::vec3 color = {1.f, 1.f, 1.f};
-    glm::vec3 emission = {0.f, 0.f, 0.f};
-    Material material = Material::Diffuse;
     Shape shape = Shape::Plane;
 
     glm::vec3 plane_normal = {0.f, 0.f, 1.f};
@@ -32,18 +31,46 @@ struct Object {
     glm::vec3 tri_A = {0.f, 0.f, 0.f};
     glm::vec3 tri_B = {0.f, 0.f, 0.f};
     glm::vec3 tri_C = {0.f, 0.f, 0.f};
-    float dielectric_ior = 1.33f;
+
+    // World space vertex A and edges of a triangle, set by finalize() so the tests don't rotate the vertices per ray.
+    glm::vec3 world_a = {0.f, 0.f, 0.f};
+    glm::vec3 world_e1 = {0.f, 0.f, 0.f};
+    glm::vec3 world_e2 = {0.f, 0.f, 0.f};
 
     Ray translate(const Ray& r) const;
     OptInsc intersect(const Ray& r) const;
+    bool occluded(const Ray& r, float t_max) const;
 
     glm::vec3 get_center() const;
+    void finalize();
+    void get_triangle(glm::vec3& a, glm::vec3& e1, glm::vec3& e2) const;
+};
 
-private:
-    OptInsc intersect_plane(const Ray& r) const;
-    OptInsc intersect_ellipsoid(const Ray& r) const;
-    OptInsc intersect_box(const Ray& r) const;
-    OptInsc intersect_triangle(const Ray& r) const;
+// Shading attributes of a primitive, kept apart from its Geometry at the same index and read only for the closest hit.
+struct Object {
+    glm::vec3 color = {1.f, 1.f, 1.f};
+    glm::vec3 emission = {0.f, 0.f, 0.f};
+    Material material = Material::Diffuse;
+    float dielectric_ior = 1.33f;
 };
 
+// Intersection tests shared by Geometry and the primitive blocks so both give identical results. Triangles are tested
+// in world space, the other shapes in object space.
+Ray translate(const Ray& r, const glm::vec3& position, const glm::quat& inv_rotation);
+OptInsc to_world(OptInsc result, const Ray& local, const glm::quat& rotation);
+float ellipsoid_distance(const glm::vec3& radius, const Ray& r);
+float box_distance(const glm::vec3& size, const Ray& r);
+glm::vec3 ellipsoid_normal(const glm::vec3& radius, const Ray& r, float t);
+glm::vec3 box_normal(const glm::vec3& size, const Ray& r, float t);
+glm::vec3 triangle_normal(const glm::vec3& e1, const glm::vec3& e2, const glm::vec3& dir);
+OptInsc intersect_plane(const glm::vec3& normal, const Ray& r);
+OptInsc intersect_ellipsoid(const glm::vec3& radius, const Ray& r);
+OptInsc intersect_box(const glm::vec3& size, const Ray& r);
+float triangle_distance(const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, const Ray& r, float& u, float& v);
+OptInsc intersect_triangle(const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, const Ray& r);
+bool occluded_plane(const glm::vec3& normal, const Ray& r, float t_max);
+bool occluded_ellipsoid(const glm::vec3& radius, const Ray& r, float t_max);
+bool occluded_box(const glm::vec3& size, const Ray& r, float t_max);
+bool occluded_triangle(const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, const Ray& r, float t_max);
+
 } // namespace raytracing
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "bvh.hpp"
+
+namespace raytracing {
+
+// N rays traversing the BVH together; lanes past the ray count and finished lanes are masked out.
+template <int N> struct RayPacket {
+    alignas(16) float pos[3][N];
+    alignas(16) float inv_dir[3][N];
+    alignas(16) float max_distance[N];
+    int active;
+
+    // Interval bounds over all lanes, used to cull nodes for the whole packet when all lanes share direction signs.
+    bool coherent;
+    int sign[3];
+    glm::vec3 pos_min, pos_max;
+    glm::vec3 inv_dir_min, inv_dir_max;
+
+    RayPacket(const Ray *rays, int n, const float *distances);
+    int intersect(const AABB &aabb, int mask) const;
+};
+
+template <int N>
+void intersect_packet(const BVH &bvh,
+                      const std::vector<Object> &primitives,
+                      const Ray *rays,
+                      int n,
+                      std::pair<OptInsc, const Object *> *nearest,
+                      float *max_distance);
+
+} // namespace raytracing
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "object.hpp"
+
+namespace raytracing {
+
+static constexpr int block_lanes = 4;
+
+// Intersection data of the primitives in the order of the BVH references, so that the primitives of a leaf are tested
+// with one vector kernel. A primitive referenced by several leaves gets a record in each.
+// Boxes and ellipsoids keep position, inverse rotation and half extents, their rotation is the conjugate of the inverse.
+// Triangles keep a world-space vertex and two edges. Each primitive's fields share one 48 byte record, so a block of
+// four lanes reads three or four cache lines and is transposed into structure-of-arrays registers on load.
+// The BVH sorts the primitives of each leaf by shape; a block is a run of up to four primitives of the same shape, and
+// the kernel for that shape is the exact test, with the same arithmetic as the scalar tests in object.cpp.
+// Traversal reads neither the Geometry nor the Objects; only the Object of the closest hit is looked up for shading.
+struct PrimitiveBlocks {
+    static constexpr int n_fields = 11;
+
+    struct Record {
+        float fields[n_fields];
+        // shape in the low two bits, the index of the primitive in the rest
+        uint32_t tag;
+
+        Shape shape() const { return static_cast<Shape>(tag & 3); }
+        int primitive() const { return tag >> 2; }
+    };
+
+    std::vector<Record> records;
+
+    void build(const std::vector<Geometry> &primitives, const std::vector<int> &references);
+    void update(const std::vector<Geometry> &primitives, const std::vector<int> &references, int first);
+    size_t memory_footprint() const;
+    int block_size(int first, int end) const;
+    int hits(int first, int count, const Ray &r, float max_distance, float *t) const;
+    Intersection intersection(int i, const Ray &r, float t) const;
+    OptInsc intersect(int i, const Ray &r) const;
+    bool occluded(int i, const Ray &r, float t_max) const;
+};
+
+} // namespace raytracing
@@ -8,25 +8,48 @@
 #include "object.hpp"
 #include "ray.hpp"
 #include "bvh.hpp"
+#include "bvh4.hpp"
+#include "bvh8.hpp"
+#include "grid.hpp"
 #include "random_context.hpp"
+#include "tlas.hpp"
 
 namespace raytracing {
 
+enum Accelerator { Binary, Wide4, Wide8, UniformGrid };
+
 struct Scene {
     Camera camera;
+    std::vector<Geometry> geometry;
     std::vector<Object> objects;
-    std::vector<Object> planes;
+    std::vector<Geometry> planes;
+    std::vector<Object> plane_objects;
     BVH bvh;
+    BVH4 bvh4;
+    BVH8 bvh8;
+    Grid grid;
+    TLAS tlas;
+    Accelerator accelerator = Accelerator::Binary;
+    bool auto_accelerator = false;
+    int packet_size = 1;
     glm::vec3 bg_color;
     int ray_depth;
     int n_samples;
 
     Scene(std::string fp);
+    void update();
+    std::vector<int> insert(std::vector<Geometry> added, const std::vector<Object>& added_objects);
+    void remove(const std::vector<int>& ids);
     void render(std::string fp, int n_threads) const;
+    bool occluded(const Ray& ray, float t_max = std::numeric_limits<float>::infinity()) const;
 
 private:
+    void build_grid();
+    void build_wide();
     std::pair<OptInsc, const Object*> intersect(const Ray& ray, float max_distance = std::numeric_limits<float>::infinity()) const;
+    void intersect_packet(const Ray* rays, int n, std::pair<OptInsc, const Object*>* hits) const;
     glm::vec3 get_color(const Ray& ray, int depth, RandomContext& ctx) const;
+    glm::vec3 shade(const Ray& ray, const std::pair<OptInsc, const Object*>& hit, int depth, RandomContext& ctx) const;
 };
 
 } // namespace raytracing
\ No newline at end of file
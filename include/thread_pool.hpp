@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raytracing {
+
+struct ThreadPool {
+    ThreadPool(int n_threads);
+    ~ThreadPool();
+
+    void push(std::function<void()> task);
+    bool run_pending();
+    int size() const;
+
+    static ThreadPool &shared();
+
+private:
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+};
+
+// wait() rethrows the first exception thrown by a task of the group, once all of its tasks have finished.
+struct TaskGroup {
+    TaskGroup(ThreadPool &pool = ThreadPool::shared());
+    ~TaskGroup();
+
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    void drain();
+
+    ThreadPool &pool;
+    std::atomic_int pending = 0;
+    std::mutex error_lock;
+    std::exception_ptr error;
+};
+
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)> &f);
+
+} // namespace raytracing
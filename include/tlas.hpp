@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "object.hpp"
+
+namespace raytracing {
+
+// Primitives shared by all instances of a group, with their own bottom-level BVH in group space.
+struct Group {
+    std::string name;
+    std::vector<Geometry> geometry;
+    std::vector<Object> objects;
+    std::vector<Mesh> meshes;
+    BVH bvh;
+};
+
+struct Instance {
+    glm::vec3 position = {0.f, 0.f, 0.f};
+    glm::quat rotation = {1.f, 0.f, 0.f, 0.f};
+    glm::quat inv_rotation = {1.f, 0.f, 0.f, 0.f};
+    int group = -1;
+
+    Ray translate(const Ray &r) const;
+};
+
+struct TLAS {
+    std::vector<Group> groups;
+    std::vector<Instance> instances;
+    BVH bvh;
+
+    int find_group(const std::string &name) const;
+    void build(const BVH &settings);
+    void intersect(const Ray &r, std::pair<OptInsc, const Object *> &nearest, float &max_distance) const;
+    bool occluded(const Ray &r, float t_max) const;
+};
+
+} // namespace raytracing
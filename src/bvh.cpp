@@ -1,8 +1,11 @@
 #include "bvh.hpp"
 
+#include <algorithm>
 #include <numeric>
 #include <stdexcept>
 
+#include "thread_pool.hpp"
+
 namespace raytracing {
 
 void AABB::extend(const glm::vec3& p) {
@@ -15,24 +18,29 @@ void AABB::extend(const AABB& aabb) {
     max = glm::max(max, aabb.max);
 }
 
-void AABB::extend(const Object &obj) {
+void AABB::extend(const Geometry &obj) {
+    // A rotated box or ellipsoid extends along each world axis by the dot product of its half extents with the absolute
+    // row of the rotation matrix, which is exact for both. Triangles bound their transformed vertices.
     AABB res;
+    glm::mat3 rotation = glm::mat3_cast(obj.rotation);
 
     switch (obj.shape) {
-    case Shape::Box: {
-        res.min = -obj.box_size;
-        res.max = obj.box_size;
-        break;
-    }
+    case Shape::Box:
     case Shape::Ellipsoid: {
-        res.min = -obj.ellipsoid_radius;
-        res.max = obj.ellipsoid_radius;
+        glm::vec3 size = obj.shape == Shape::Box ? obj.box_size : obj.ellipsoid_radius;
+        glm::vec3 half;
+        for (int axis = 0; axis < 3; ++axis) {
+            glm::vec3 row(rotation[0][axis], rotation[1][axis], rotation[2][axis]);
+            half[axis] = obj.shape == Shape::Box ? glm::dot(glm::abs(row), size) : glm::length(row * size);
+        }
+        res.extend(obj.position - half);
+        res.extend(obj.position + half);
         break;
     }
     case Shape::Triangle: {
-        res.extend(obj.tri_A);
-        res.extend(obj.tri_B);
-        res.extend(obj.tri_C);
+        res.extend(obj.position + rotation * obj.tri_A);
+        res.extend(obj.position + rotation * obj.tri_B);
+        res.extend(obj.position + rotation * obj.tri_C);
         break;
     }
     case Shape::Plane: {
@@ -41,14 +49,10 @@ void AABB::extend(const Object &obj) {
     }
     }
 
-    extend(obj.position + obj.rotation * glm::vec3(res.min.x, res.min.y, res.min.z));
-    extend(obj.position + obj.rotation * glm::vec3(res.min.x, res.min.y, res.max.z));
-    extend(obj.position + obj.rotation * glm::vec3(res.min.x, res.max.y, res.min.z));
-    extend(obj.position + obj.rotation * glm::vec3(res.min.x, res.max.y, res.max.z));
-    extend(obj.position + obj.rotation * glm::vec3(res.max.x, res.min.y, res.min.z));
-    extend(obj.position + obj.rotation * glm::vec3(res.max.x, res.min.y, res.max.z));
-    extend(obj.position + obj.rotation * glm::vec3(res.max.x, res.max.y, res.min.z));
-    extend(obj.position + obj.rotation * glm::vec3(res.max.x, res.max.y, res.max.z));
+    // the intersection routines transform rays with the quaternion, so leave room for their rounding
+    glm::vec3 margin = (glm::abs(res.min) + glm::abs(res.max)) * 1e-6f;
+    extend(res.min - margin);
+    extend(res.max + margin);
 }
 
 float AABB::S() const {
@@ -56,30 +60,35 @@ float AABB::S() const {
     return diag.x * diag.y + diag.y * diag.z + diag.z * diag.x;
 }
 
-int BVH::build_node(std::vector<Object> &primitives, int first, int count) {
+static constexpr int parallel_build_threshold = 4096;
+static constexpr int parallel_binning_threshold = 1 << 16;
+static constexpr int parallel_binning_grain = 1 << 14;
+
+int BVH::build_node(std::vector<PrimitiveRef> &refs, int first, int count, std::atomic_int &node_count) {
     if (count == 0) {
         return -1;
     }
 
-    Node result;
+    BuildNode result;
     result.first_primitive_id = first;
     result.primitive_count = count;
 
     if (count <= 4) {
     no_split:
         for (int i = first; i < first + count; ++i) {
-            result.aabb.extend(primitives[i]);
+            result.aabb.extend(refs[i].aabb);
         }
         result.left_child = -1;
         result.right_child = -1;
-        nodes.push_back(result);
-        return nodes.size() - 1;
+        int result_i = node_count++;
+        build_nodes[result_i] = result;
+        return result_i;
     }
 
-    std::function<bool(const Object &, const Object &)> cmp_x = [&](const Object &x, const Object &y) { return x.center.x < y.center.x; };
-    std::function<bool(const Object &, const Object &)> cmp_y = [&](const Object &x, const Object &y) { return x.center.y < y.center.y; };
-    std::function<bool(const Object &, const Object &)> cmp_z = [&](const Object &x, const Object &y) { return x.center.z < y.center.z; };
-    std::vector<std::function<bool(const Object &, const Object &)> *> cmps{&cmp_x, &cmp_y, &cmp_z};
+    auto cmp_x = [](const PrimitiveRef &x, const PrimitiveRef &y) { return x.center.x < y.center.x; };
+    auto cmp_y = [](const PrimitiveRef &x, const PrimitiveRef &y) { return x.center.y < y.center.y; };
+    auto cmp_z = [](const PrimitiveRef &x, const PrimitiveRef &y) { return x.center.z < y.center.z; };
+    std::function<bool(const PrimitiveRef &, const PrimitiveRef &)> cmps[3] = {cmp_x, cmp_y, cmp_z};
 
     float best_score = 0.f;
     int best_i = -1;
@@ -88,21 +97,21 @@ int BVH::build_node(std::vector<Object> &primitives, int first, int count) {
     std::vector<std::vector<AABB>> right_aabbs(3, std::vector<AABB>());
 
     for (int axis = 0; axis < 3; ++axis) {
-        std::sort(&primitives[first], &primitives[first + count], *cmps[axis]);
+        std::sort(&refs[first], &refs[first] + count, cmps[axis]);
 
         AABB aabb;
         for (int i = first; i < first + count - 1; ++i) {
-            aabb.extend(primitives[i]);
+            aabb.extend(refs[i].aabb);
             left_aabbs[axis].push_back(aabb);
         }
         aabb = {};
         for (int i = first + count - 1; i > first; --i) {
-            aabb.extend(primitives[i]);
+            aabb.extend(refs[i].aabb);
             right_aabbs[axis].push_back(aabb);
         }
         if (axis == 0) {
             result.aabb = aabb;
-            result.aabb.extend(primitives[first]);
+            result.aabb.extend(refs[first].aabb);
             best_score = result.aabb.S() * count;
         }
 
@@ -121,76 +130,465 @@ int BVH::build_node(std::vector<Object> &primitives, int first, int count) {
     }
 
     if (best_axis != 2) {
-        std::sort(&primitives[first], &primitives[first + count], *cmps[best_axis]);
+        std::sort(&refs[first], &refs[first] + count, cmps[best_axis]);
     }
 
     result.split_axis = best_axis;
 
-    nodes.push_back(result);
-    int result_i = nodes.size() - 1;
-
-    nodes[result_i].left_child = build_node(primitives, first, best_i + 1);
-    nodes[result_i].right_child = build_node(primitives, first + best_i + 1, count - best_i - 1);
+    int result_i = node_count++;
+    auto build_left = [&]() { result.left_child = build_node(refs, first, best_i + 1, node_count); };
+    auto build_right = [&]() { result.right_child = build_node(refs, first + best_i + 1, count - best_i - 1, node_count); };
+    if (count >= parallel_build_threshold) {
+        TaskGroup group;
+        group.run(build_left);
+        build_right();
+        group.wait();
+    } else {
+        build_left();
+        build_right();
+    }
+    build_nodes[result_i] = result;
 
     return result_i;
 }
 
-void BVH::build(std::vector<Object> &primitives) { root = build_node(primitives, 0, primitives.size()); }
+static constexpr int bin_count = 16;
+
+struct Bins {
+    AABB aabbs[3][bin_count];
+    int sizes[3][bin_count] = {};
+
+    void extend(const Bins &other) {
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int bin = 0; bin < bin_count; ++bin) {
+                aabbs[axis][bin].extend(other.aabbs[axis][bin]);
+                sizes[axis][bin] += other.sizes[axis][bin];
+            }
+        }
+    }
+};
+
+int BVH::build_node_binned(std::vector<PrimitiveRef> &refs, int first, int count, std::atomic_int &node_count) {
+    if (count == 0) {
+        return -1;
+    }
+
+    BuildNode result;
+    result.first_primitive_id = first;
+    result.primitive_count = count;
+
+    AABB centroid_aabb;
+    if (count >= parallel_binning_threshold) {
+        int n_chunks = (count + parallel_binning_grain - 1) / parallel_binning_grain;
+        std::vector<std::pair<AABB, AABB>> chunk_aabbs(n_chunks);
+        parallel_for(0, n_chunks, 1, [&](int chunk, int) {
+            for (int i = first + chunk * parallel_binning_grain; i < std::min(first + count, first + (chunk + 1) * parallel_binning_grain); ++i) {
+                chunk_aabbs[chunk].first.extend(refs[i].aabb);
+                chunk_aabbs[chunk].second.extend(refs[i].center);
+            }
+        });
+        for (auto &[aabb, centroids] : chunk_aabbs) {
+            result.aabb.extend(aabb);
+            centroid_aabb.extend(centroids);
+        }
+    } else {
+        for (int i = first; i < first + count; ++i) {
+            result.aabb.extend(refs[i].aabb);
+            centroid_aabb.extend(refs[i].center);
+        }
+    }
+
+    if (count <= 4) {
+        int result_i = node_count++;
+        build_nodes[result_i] = result;
+        return result_i;
+    }
+
+    glm::vec3 extent = centroid_aabb.max - centroid_aabb.min;
+    glm::vec3 scale = glm::vec3(bin_count) / extent;
+    auto get_bin = [&](const PrimitiveRef &ref, int axis) {
+        int bin = static_cast<int>((ref.center[axis] - centroid_aabb.min[axis]) * scale[axis]);
+        return std::clamp(bin, 0, bin_count - 1);
+    };
+
+    auto fill_bins = [&](Bins &bins, int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                if (extent[axis] <= 0.f) {
+                    continue;
+                }
+                int bin = get_bin(refs[i], axis);
+                bins.aabbs[axis][bin].extend(refs[i].aabb);
+                ++bins.sizes[axis][bin];
+            }
+        }
+    };
+
+    Bins bins;
+    if (count >= parallel_binning_threshold) {
+        int n_chunks = (count + parallel_binning_grain - 1) / parallel_binning_grain;
+        std::vector<Bins> chunk_bins(n_chunks);
+        parallel_for(0, n_chunks, 1, [&](int chunk, int) {
+            fill_bins(chunk_bins[chunk], first + chunk * parallel_binning_grain, std::min(first + count, first + (chunk + 1) * parallel_binning_grain));
+        });
+        for (auto &chunk : chunk_bins) {
+            bins.extend(chunk);
+        }
+    } else {
+        fill_bins(bins, first, first + count);
+    }
+
+    float best_score = result.aabb.S() * count;
+    int best_bin = -1;
+    int best_axis = -1;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.f) {
+            continue;
+        }
+
+        float right_scores[bin_count];
+        AABB aabb;
+        int size = 0;
+        for (int bin = bin_count - 1; bin > 0; --bin) {
+            aabb.extend(bins.aabbs[axis][bin]);
+            size += bins.sizes[axis][bin];
+            right_scores[bin] = aabb.S() * size;
+        }
+
+        aabb = {};
+        size = 0;
+        for (int bin = 0; bin < bin_count - 1; ++bin) {
+            aabb.extend(bins.aabbs[axis][bin]);
+            size += bins.sizes[axis][bin];
+            if (size == 0 || size == count) {
+                continue;
+            }
+            float score = aabb.S() * size + right_scores[bin + 1];
+            if (score < best_score) {
+                best_score = score;
+                best_axis = axis;
+                best_bin = bin;
+            }
+        }
+    }
+
+    int result_i = node_count++;
 
-static float min3(float x, float y, float z) { return std::min(x, std::min(y, z)); }
+    if (best_axis == -1) {
+        build_nodes[result_i] = result;
+        return result_i;
+    }
 
-static float max3(float x, float y, float z) { return std::max(x, std::max(y, z)); }
+    auto mid = std::partition(&refs[first], &refs[first] + count, [&](const PrimitiveRef &ref) { return get_bin(ref, best_axis) <= best_bin; });
+    int left_count = mid - &refs[first];
+
+    result.split_axis = best_axis;
 
-void BVH::intersect(
-    const std::vector<Object> &primitives, const Ray& r, std::pair<OptInsc, const Object *> &nearest, float &max_distance, int i) const {
-    if (i == -2) {
-        i = root;
+    auto build_left = [&]() { result.left_child = build_node_binned(refs, first, left_count, node_count); };
+    auto build_right = [&]() { result.right_child = build_node_binned(refs, first + left_count, count - left_count, node_count); };
+    if (count >= parallel_build_threshold) {
+        TaskGroup group;
+        group.run(build_left);
+        build_right();
+        group.wait();
+    } else {
+        build_left();
+        build_right();
     }
+    build_nodes[result_i] = result;
+
+    return result_i;
+}
 
-    auto &node = nodes[i];
-    glm::vec3 tm = (node.aabb.min - r.pos) / r.dir;
-    glm::vec3 tM = (node.aabb.max - r.pos) / r.dir;
-    float t1 = max3(std::min(tm.x, tM.x), std::min(tm.y, tM.y), std::min(tm.z, tM.z));
-    float t2 = min3(std::max(tm.x, tM.x), std::max(tm.y, tM.y), std::max(tm.z, tM.z));
-    if (t1 > t2 || t2 < 0) {
+void BVH::build(std::vector<PrimitiveRef> &refs) {
+    if (method == BuildMethod::Linear) {
+        build_linear(refs);
         return;
     }
 
-    if (t1 >= max_distance) {
+    build_nodes.assign(2 * refs.size(), BuildNode());
+    std::atomic_int node_count = 0;
+
+    switch (method) {
+    case BuildMethod::Sweep:
+        root = build_node(refs, 0, refs.size(), node_count);
+        break;
+    case BuildMethod::Binned:
+        root = build_node_binned(refs, 0, refs.size(), node_count);
+        break;
+    default:
+        throw std::runtime_error("unsupported bvh build method");
+    }
+    build_nodes.resize(node_count);
+
+    flatten();
+    build_nodes.clear();
+    build_nodes.shrink_to_fit();
+}
+
+void BVH::flatten() {
+    nodes.clear();
+    if (root == -1) {
         return;
     }
-    if (node.left_child == -1 || node.right_child == -1) {
-        for (int j = node.first_primitive_id; j < node.first_primitive_id + node.primitive_count; ++j) {
-            auto insc = primitives[j].intersect(r);
-            if (insc && insc.value().t < max_distance) {
-                nearest.second = &primitives[j];
-                max_distance = insc.value().t;
-                nearest.first = insc.value();
-            }
+    nodes.reserve(build_nodes.size());
+    std::vector<std::pair<int, int *>> stack = {{root, nullptr}};
+    while (!stack.empty()) {
+        auto [i, parent_link] = stack.back();
+        stack.pop_back();
+
+        auto &build_node = build_nodes[i];
+        if (parent_link != nullptr) {
+            *parent_link = nodes.size();
         }
+        Node node;
+        node.aabb = build_node.aabb;
+        if (build_node.left_child == -1 || build_node.right_child == -1) {
+            node.offset = build_node.first_primitive_id;
+            node.primitive_count = build_node.primitive_count;
+            nodes.push_back(node);
+        } else {
+            node.split_axis = build_node.split_axis;
+            nodes.push_back(node);
+            stack.push_back({build_node.right_child, &nodes.back().offset});
+            stack.push_back({build_node.left_child, nullptr});
+        }
+    }
+    root = 0;
+}
+
+// The primitives keep their order, leaves reach them through references. primitive_ids[i] is the stable id of
+// primitive i; ids start as the indices of the first build and follow the primitives through edits.
+void BVH::build(const std::vector<Geometry> &primitives) {
+    int n = primitives.size();
+    if (static_cast<int>(primitive_ids.size()) != n) {
+        primitive_ids.resize(n);
+        std::iota(primitive_ids.begin(), primitive_ids.end(), 0);
+        next_primitive_id = n;
+    }
+    depth_first = true;
+    parents.clear();
+    free_nodes.clear();
+
+    loaded_from_cache = false;
+    uint64_t key = 0;
+    if (!cache_directory.empty()) {
+        key = geometry_hash(primitives);
+        if (load(cache_path(key), key, primitives.size())) {
+            loaded_from_cache = true;
+            built_sah_cost = sah_cost();
+            blocks.build(primitives, references);
+            return;
+        }
+    }
+
+    std::vector<PrimitiveRef> refs(n);
+    for (int i = 0; i < n; ++i) {
+        refs[i].aabb.extend(primitives[i]);
+        refs[i].center = primitives[i].center;
+        refs[i].index = i;
+    }
+
+    if (method == BuildMethod::Spatial) {
+        build_spatial(refs, primitives);
     } else {
-        bool reverse_order = false;
-        switch (node.split_axis) {
-        case 0:
-            reverse_order = r.dir.x < 0;
-            break;
-        case 1:
-            reverse_order = r.dir.y < 0;
-            break;
-        case 2:
-            reverse_order = r.dir.z < 0;
+        build(refs);
+    }
+    // the primitive blocks group a leaf's primitives by shape
+    for (auto &node : nodes) {
+        if (node.is_leaf()) {
+            std::stable_sort(refs.begin() + node.offset, refs.begin() + node.offset + node.primitive_count,
+                             [&](const PrimitiveRef &a, const PrimitiveRef &b) { return primitives[a.index].shape < primitives[b.index].shape; });
+        }
+    }
+
+    references.resize(refs.size());
+    for (size_t i = 0; i < refs.size(); ++i) {
+        references[i] = refs[i].index;
+    }
+    if (!cache_directory.empty()) {
+        save(cache_path(key), key);
+    }
+    built_sah_cost = sah_cost();
+    blocks.build(primitives, references);
+}
+
+static constexpr int parallel_refit_grain = 1 << 14;
+
+// Children are always stored after their parent, so a reverse sweep over a subtree's node range is bottom-up.
+void BVH::refit_subtree(const std::vector<Geometry> &primitives, int first, int end) {
+    for (int i = end - 1; i >= first; --i) {
+        auto &node = nodes[i];
+        node.aabb = AABB();
+        if (node.is_leaf()) {
+            for (int j = node.offset; j < node.offset + static_cast<int>(node.primitive_count); ++j) {
+                node.aabb.extend(primitives[references[j]]);
+            }
+        } else {
+            node.aabb.extend(nodes[i + 1].aabb);
+            node.aabb.extend(nodes[node.offset].aabb);
+        }
+    }
+}
+
+void BVH::refit(const std::vector<Geometry> &primitives) {
+    relayout();
+    if (root != -1) {
+        refit_subtree(primitives, root, nodes.size());
+    }
+    blocks.build(primitives, references);
+}
+
+void BVH::refit_parallel(const std::vector<Geometry> &primitives) {
+    relayout();
+    if (root == -1) {
+        return;
+    }
+
+    std::function<void(int, int)> refit_node = [&](int i, int end) {
+        auto &node = nodes[i];
+        if (node.is_leaf() || end - i <= parallel_refit_grain) {
+            refit_subtree(primitives, i, end);
+            return;
+        }
+        TaskGroup group;
+        group.run([&]() { refit_node(i + 1, node.offset); });
+        refit_node(node.offset, end);
+        group.wait();
+        node.aabb = nodes[i + 1].aabb;
+        node.aabb.extend(nodes[node.offset].aabb);
+    };
+    refit_node(root, nodes.size());
+    blocks.build(primitives, references);
+}
+
+// The rebuild starts again from the unique primitives, so spatial splits do not pile up over repeated updates.
+bool BVH::update(const std::vector<Geometry> &primitives) {
+    refit_parallel(primitives);
+    if (sah_cost() <= built_sah_cost * rebuild_threshold) {
+        return false;
+    }
+    build(primitives);
+    return true;
+}
+
+std::vector<int> BVH::wide_children(int i, int width) const {
+    if (nodes[i].is_leaf()) {
+        return {i};
+    }
+
+    std::vector<int> children = {i + 1, nodes[i].offset};
+    while (static_cast<int>(children.size()) < width) {
+        int best = -1;
+        for (int k = 0; k < static_cast<int>(children.size()); ++k) {
+            auto &node = nodes[children[k]];
+            if (!node.is_leaf() && (best == -1 || node.aabb.S() > nodes[children[best]].aabb.S())) {
+                best = k;
+            }
+        }
+        if (best == -1) {
             break;
-        default:
-            throw std::runtime_error("split axis must be 0, 1 or 2");
         }
-        if (reverse_order) {
-            intersect(primitives, r, nearest, max_distance, node.right_child);
-            intersect(primitives, r, nearest, max_distance, node.left_child);
+        int expanded = children[best];
+        children[best] = expanded + 1;
+        children.push_back(nodes[expanded].offset);
+    }
+    return children;
+}
+
+static constexpr float traversal_cost = 1.2f;
+static constexpr float intersection_cost = 1.f;
+
+float BVH::node_cost(const Node &node) {
+    return node.aabb.S() * (node.is_leaf() ? node.primitive_count * intersection_cost : traversal_cost);
+}
+
+float BVH::sah_cost() const {
+    if (root < 0) {
+        return 0.f;
+    }
+    float root_area = nodes[root].aabb.S();
+    if (root_area <= 0.f) {
+        return 0.f;
+    }
+    if (!depth_first) {
+        return edit_cost / root_area;
+    }
+    float cost = 0.f;
+    for (auto &node : nodes) {
+        if (node.is_leaf()) {
+            cost += node.aabb.S() / root_area * node.primitive_count * intersection_cost;
         } else {
-            intersect(primitives, r, nearest, max_distance, node.left_child);
-            intersect(primitives, r, nearest, max_distance, node.right_child);
+            cost += node.aabb.S() / root_area * traversal_cost;
         }
     }
+    return cost;
+}
+
+TraversalRay::TraversalRay(const Ray &r) : pos(r.pos), inv_dir(1.f / r.dir) {
+    sign[0] = inv_dir.x < 0;
+    sign[1] = inv_dir.y < 0;
+    sign[2] = inv_dir.z < 0;
+}
+
+bool TraversalRay::intersect(const AABB &aabb, float max_distance, float &t_entry) const {
+    const glm::vec3 *bounds = &aabb.min;
+    float t1 = (bounds[sign[0]].x - pos.x) * inv_dir.x;
+    float t2 = (bounds[1 - sign[0]].x - pos.x) * inv_dir.x;
+    t1 = std::max(t1, (bounds[sign[1]].y - pos.y) * inv_dir.y);
+    t2 = std::min(t2, (bounds[1 - sign[1]].y - pos.y) * inv_dir.y);
+    t1 = std::max(t1, (bounds[sign[2]].z - pos.z) * inv_dir.z);
+    t2 = std::min(t2, (bounds[1 - sign[2]].z - pos.z) * inv_dir.z);
+    t_entry = t1;
+    return t1 <= t2 && t2 >= 0 && t1 < max_distance;
+}
+
+// A leaf is tested in blocks of primitives that share a shape; only the closest hit of a block computes its normal.
+void intersect_primitives(const std::vector<Object> &primitives,
+                          const PrimitiveBlocks &blocks,
+                          int first,
+                          int count,
+                          const Ray &r,
+                          std::pair<OptInsc, const Object *> &nearest,
+                          float &max_distance) {
+    for (int base = first; base < first + count;) {
+        int size = blocks.block_size(base, first + count);
+        float t[block_lanes];
+        int best = -1;
+        for (int mask = blocks.hits(base, size, r, max_distance, t); mask != 0; mask &= mask - 1) {
+            int k = __builtin_ctz(mask);
+            if (t[k] < max_distance) {
+                max_distance = t[k];
+                best = base + k;
+            }
+        }
+        if (best != -1) {
+            nearest.first = blocks.intersection(best, r, max_distance);
+            nearest.second = &primitives[blocks.records[best].primitive()];
+        }
+        base += size;
+    }
+}
+
+bool occluded_primitives(const PrimitiveBlocks &blocks, int first, int count, const Ray &r, float t_max) {
+    for (int base = first; base < first + count;) {
+        int size = blocks.block_size(base, first + count);
+        float t[block_lanes];
+        if (blocks.hits(base, size, r, t_max, t) != 0) {
+            return true;
+        }
+        base += size;
+    }
+    return false;
+}
+
+void BVH::intersect(const std::vector<Object> &primitives, const Ray &r, std::pair<OptInsc, const Object *> &nearest, float &max_distance) const {
+    traverse(r, max_distance, [&](int first, int count) { intersect_primitives(primitives, blocks, first, count, r, nearest, max_distance); });
+}
+
+bool BVH::occluded(const Ray &r, float t_max) const {
+    return traverse_any(r, t_max, [&](int first, int count) { return occluded_primitives(blocks, first, count, r, t_max); });
 }
 
-} // namespace raytracing
\ No newline at end of file
+} // namespace raytracing
@@ -0,0 +1,171 @@
+#include "bvh4.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+namespace raytracing {
+
+int BVH4::collapse_node(const BVH &bvh, int i) {
+    std::vector<int> slots = bvh.wide_children(i, 4);
+
+    Node4 result;
+    for (int k = 0; k < 4; ++k) {
+        AABB aabb;
+        result.children[k] = -1;
+        result.primitive_counts[k] = 0;
+        if (k < static_cast<int>(slots.size())) {
+            auto &node = bvh.nodes[slots[k]];
+            aabb = node.aabb;
+            if (node.is_leaf()) {
+                result.children[k] = node.offset;
+                result.primitive_counts[k] = node.primitive_count;
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            result.bounds[axis][k] = aabb.min[axis];
+            result.bounds[axis + 3][k] = aabb.max[axis];
+        }
+    }
+
+    nodes.push_back(result);
+    int result_i = nodes.size() - 1;
+
+    for (int k = 0; k < static_cast<int>(slots.size()); ++k) {
+        auto &node = bvh.nodes[slots[k]];
+        if (!node.is_leaf()) {
+            int child = collapse_node(bvh, slots[k]);
+            nodes[result_i].children[k] = child;
+        }
+    }
+
+    return result_i;
+}
+
+void BVH4::build(const BVH &bvh) {
+    nodes.clear();
+    blocks = &bvh.blocks;
+    root = bvh.root == -1 ? -1 : collapse_node(bvh, bvh.root);
+}
+
+static int intersect_children(const Node4 &node, const TraversalRay &ray, float max_distance, float *t_entry) {
+#if defined(__SSE__)
+    __m128 t_near = _mm_setzero_ps();
+    __m128 t_far = _mm_set1_ps(max_distance);
+    for (int axis = 0; axis < 3; ++axis) {
+        __m128 pos = _mm_set1_ps(ray.pos[axis]);
+        __m128 inv_dir = _mm_set1_ps(ray.inv_dir[axis]);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[axis + 3 * ray.sign[axis]]), pos), inv_dir);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[axis + 3 * (1 - ray.sign[axis])]), pos), inv_dir);
+        t_near = _mm_max_ps(t1, t_near);
+        t_far = _mm_min_ps(t2, t_far);
+    }
+    _mm_storeu_ps(t_entry, t_near);
+    return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+#else
+    int mask = 0;
+    for (int k = 0; k < 4; ++k) {
+        float t_near = 0.f;
+        float t_far = max_distance;
+        for (int axis = 0; axis < 3; ++axis) {
+            float t1 = (node.bounds[axis + 3 * ray.sign[axis]][k] - ray.pos[axis]) * ray.inv_dir[axis];
+            float t2 = (node.bounds[axis + 3 * (1 - ray.sign[axis])][k] - ray.pos[axis]) * ray.inv_dir[axis];
+            t_near = std::max(t1, t_near);
+            t_far = std::min(t2, t_far);
+        }
+        t_entry[k] = t_near;
+        mask |= (t_near <= t_far) << k;
+    }
+    return mask;
+#endif
+}
+
+void BVH4::intersect(const std::vector<Object> &primitives,
+                     const Ray &r,
+                     std::pair<OptInsc, const Object *> &nearest,
+                     float &max_distance) const {
+    if (root == -1) {
+        return;
+    }
+
+    TraversalRay ray(r);
+    TraversalStack stack;
+    int i = root;
+    while (true) {
+        auto &node = nodes[i];
+        float t_entry[4];
+        int mask = intersect_children(node, ray, max_distance, t_entry);
+
+        int hits[4];
+        int n_hits = 0;
+        for (int k = 0; k < 4; ++k) {
+            if (mask >> k & 1) {
+                hits[n_hits++] = k;
+            }
+        }
+        sort_far_to_near(hits, n_hits, t_entry);
+        for (int h = 0; h < n_hits; ++h) {
+            stack.push(i * 4 + hits[h], t_entry[hits[h]]);
+        }
+
+        i = -1;
+        while (stack.size > 0) {
+            auto [slot, t] = stack.pop();
+            if (t >= max_distance) {
+                continue;
+            }
+            auto &parent = nodes[slot / 4];
+            int k = slot % 4;
+            if (parent.primitive_counts[k] > 0) {
+                intersect_primitives(primitives, *blocks, parent.children[k], parent.primitive_counts[k], r, nearest, max_distance);
+                continue;
+            }
+            i = parent.children[k];
+            break;
+        }
+        if (i == -1) {
+            return;
+        }
+    }
+}
+
+bool BVH4::occluded(const Ray &r, float t_max) const {
+    if (root == -1) {
+        return false;
+    }
+
+    TraversalRay ray(r);
+    TraversalStack stack;
+    stack.push(-1, 0.f);
+    int i = root;
+    while (true) {
+        float t_entry[4];
+        int mask = intersect_children(nodes[i], ray, t_max, t_entry);
+        for (int k = 0; k < 4; ++k) {
+            if (mask >> k & 1) {
+                stack.push(i * 4 + k, t_entry[k]);
+            }
+        }
+
+        while (true) {
+            int slot = stack.pop().first;
+            if (slot == -1) {
+                return false;
+            }
+            auto &parent = nodes[slot / 4];
+            int k = slot % 4;
+            if (parent.primitive_counts[k] > 0) {
+                if (occluded_primitives(*blocks, parent.children[k], parent.primitive_counts[k], r, t_max)) {
+                    return true;
+                }
+                continue;
+            }
+            i = parent.children[k];
+            break;
+        }
+    }
+}
+
+} // namespace raytracing
@@ -0,0 +1,251 @@
+#include "bvh8.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BVH8_AVX2
+#endif
+
+namespace raytracing {
+
+// 255 steps of 2^max_exponent stay finite, so dequantized bounds never overflow.
+static constexpr int min_exponent = -126;
+static constexpr int max_exponent = 119;
+
+static float exponent_scale(int8_t exponent) {
+    uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+static float dequantize(float origin, uint8_t q, float scale) { return origin + static_cast<float>(q) * scale; }
+
+static void quantize(Node8 &node, const AABB &parent, const AABB *aabbs, int n) {
+    node.origin = parent.min;
+    for (int axis = 0; axis < 3; ++axis) {
+        float extent = parent.max[axis] - parent.min[axis];
+        int exponent = min_exponent;
+        if (extent > 0.f) {
+            exponent = std::clamp(static_cast<int>(std::ceil(std::log2(extent / 255.f))), min_exponent, max_exponent);
+            while (exponent < max_exponent && 255.f * exponent_scale(exponent) < extent) {
+                ++exponent;
+            }
+        }
+        if (!(255.f * exponent_scale(exponent) >= extent)) {
+            throw std::runtime_error("scene too large for the BVH8 quantization");
+        }
+        node.exponents[axis] = exponent;
+        float scale = exponent_scale(exponent);
+
+        for (int k = 0; k < 8; ++k) {
+            if (k >= n) {
+                node.bounds[axis][k] = 255;
+                node.bounds[axis + 3][k] = 0;
+                continue;
+            }
+            float lo = std::floor((aabbs[k].min[axis] - node.origin[axis]) / scale);
+            float hi = std::ceil((aabbs[k].max[axis] - node.origin[axis]) / scale);
+            int q_lo = std::clamp(static_cast<int>(lo), 0, 255);
+            int q_hi = std::clamp(static_cast<int>(hi), 0, 255);
+            while (q_lo > 0 && dequantize(node.origin[axis], q_lo, scale) > aabbs[k].min[axis]) {
+                --q_lo;
+            }
+            while (q_hi < 255 && dequantize(node.origin[axis], q_hi, scale) < aabbs[k].max[axis]) {
+                ++q_hi;
+            }
+            node.bounds[axis][k] = q_lo;
+            node.bounds[axis + 3][k] = q_hi;
+        }
+    }
+    node.child_mask = (1 << n) - 1;
+}
+
+int BVH8::collapse_node(const BVH &bvh, int i) {
+    std::vector<int> slots = bvh.wide_children(i, 8);
+    int n = slots.size();
+
+    AABB aabbs[8];
+    Node8 result;
+    for (int k = 0; k < 8; ++k) {
+        result.children[k] = -1;
+        result.primitive_counts[k] = 0;
+        if (k < n) {
+            auto &node = bvh.nodes[slots[k]];
+            aabbs[k] = node.aabb;
+            if (node.is_leaf()) {
+                result.children[k] = node.offset;
+                result.primitive_counts[k] = node.primitive_count;
+            }
+        }
+    }
+    quantize(result, bvh.nodes[i].aabb, aabbs, n);
+
+    nodes.push_back(result);
+    int result_i = nodes.size() - 1;
+
+    for (int k = 0; k < n; ++k) {
+        auto &node = bvh.nodes[slots[k]];
+        if (!node.is_leaf()) {
+            int child = collapse_node(bvh, slots[k]);
+            nodes[result_i].children[k] = child;
+        }
+    }
+
+    return result_i;
+}
+
+void BVH8::build(const BVH &bvh) {
+    nodes.clear();
+    blocks = &bvh.blocks;
+    root = bvh.root == -1 ? -1 : collapse_node(bvh, bvh.root);
+#ifdef BVH8_AVX2
+    use_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+size_t BVH8::memory_footprint() const { return nodes.size() * sizeof(Node8); }
+
+static int intersect_children(const Node8 &node, const TraversalRay &ray, float max_distance, float *t_entry) {
+    int mask = 0;
+    for (int k = 0; k < 8; ++k) {
+        float t_near = 0.f;
+        float t_far = max_distance;
+        for (int axis = 0; axis < 3; ++axis) {
+            float scale = exponent_scale(node.exponents[axis]);
+            float near = dequantize(node.origin[axis], node.bounds[axis + 3 * ray.sign[axis]][k], scale);
+            float far = dequantize(node.origin[axis], node.bounds[axis + 3 * (1 - ray.sign[axis])][k], scale);
+            t_near = std::max((near - ray.pos[axis]) * ray.inv_dir[axis], t_near);
+            t_far = std::min((far - ray.pos[axis]) * ray.inv_dir[axis], t_far);
+        }
+        t_entry[k] = t_near;
+        mask |= (t_near <= t_far) << k;
+    }
+    return mask & node.child_mask;
+}
+
+#ifdef BVH8_AVX2
+__attribute__((target("avx2,fma"))) static int intersect_children_avx2(const Node8 &node,
+                                                                       const TraversalRay &ray,
+                                                                       float max_distance,
+                                                                       float *t_entry) {
+    __m256 t_near = _mm256_setzero_ps();
+    __m256 t_far = _mm256_set1_ps(max_distance);
+    for (int axis = 0; axis < 3; ++axis) {
+        __m256 origin = _mm256_set1_ps(node.origin[axis]);
+        __m256 scale = _mm256_set1_ps(exponent_scale(node.exponents[axis]));
+        __m256 pos = _mm256_set1_ps(ray.pos[axis]);
+        __m256 inv_dir = _mm256_set1_ps(ray.inv_dir[axis]);
+        __m128i q_near = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(node.bounds[axis + 3 * ray.sign[axis]]));
+        __m128i q_far = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(node.bounds[axis + 3 * (1 - ray.sign[axis])]));
+        __m256 near = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(q_near)), scale, origin);
+        __m256 far = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(q_far)), scale, origin);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(near, pos), inv_dir);
+        __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(far, pos), inv_dir);
+        t_near = _mm256_max_ps(t1, t_near);
+        t_far = _mm256_min_ps(t2, t_far);
+    }
+    _mm256_storeu_ps(t_entry, t_near);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)) & node.child_mask;
+}
+#endif
+
+void BVH8::intersect(const std::vector<Object> &primitives,
+                     const Ray &r,
+                     std::pair<OptInsc, const Object *> &nearest,
+                     float &max_distance) const {
+    if (root == -1) {
+        return;
+    }
+
+    TraversalRay ray(r);
+    TraversalStack stack;
+    int i = root;
+    while (true) {
+        float t_entry[8];
+#ifdef BVH8_AVX2
+        int mask = use_avx2 ? intersect_children_avx2(nodes[i], ray, max_distance, t_entry)
+                            : intersect_children(nodes[i], ray, max_distance, t_entry);
+#else
+        int mask = intersect_children(nodes[i], ray, max_distance, t_entry);
+#endif
+
+        int hits[8];
+        int n_hits = 0;
+        for (int k = 0; k < 8; ++k) {
+            if (mask >> k & 1) {
+                hits[n_hits++] = k;
+            }
+        }
+        sort_far_to_near(hits, n_hits, t_entry);
+        for (int h = 0; h < n_hits; ++h) {
+            stack.push(i * 8 + hits[h], t_entry[hits[h]]);
+        }
+
+        i = -1;
+        while (stack.size > 0) {
+            auto [slot, t] = stack.pop();
+            if (t >= max_distance) {
+                continue;
+            }
+            auto &refs = nodes[slot / 8];
+            int k = slot % 8;
+            if (refs.primitive_counts[k] > 0) {
+                intersect_primitives(primitives, *blocks, refs.children[k], refs.primitive_counts[k], r, nearest, max_distance);
+                continue;
+            }
+            i = refs.children[k];
+            break;
+        }
+        if (i == -1) {
+            return;
+        }
+    }
+}
+
+bool BVH8::occluded(const Ray &r, float t_max) const {
+    if (root == -1) {
+        return false;
+    }
+
+    TraversalRay ray(r);
+    TraversalStack stack;
+    stack.push(-1, 0.f);
+    int i = root;
+    while (true) {
+        float t_entry[8];
+#ifdef BVH8_AVX2
+        int mask = use_avx2 ? intersect_children_avx2(nodes[i], ray, t_max, t_entry) : intersect_children(nodes[i], ray, t_max, t_entry);
+#else
+        int mask = intersect_children(nodes[i], ray, t_max, t_entry);
+#endif
+        for (int k = 0; k < 8; ++k) {
+            if (mask >> k & 1) {
+                stack.push(i * 8 + k, t_entry[k]);
+            }
+        }
+
+        while (true) {
+            int slot = stack.pop().first;
+            if (slot == -1) {
+                return false;
+            }
+            auto &refs = nodes[slot / 8];
+            int k = slot % 8;
+            if (refs.primitive_counts[k] > 0) {
+                if (occluded_primitives(*blocks, refs.children[k], refs.primitive_counts[k], r, t_max)) {
+                    return true;
+                }
+                continue;
+            }
+            i = refs.children[k];
+            break;
+        }
+    }
+}
+
+} // namespace raytracing
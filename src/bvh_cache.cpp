@@ -0,0 +1,170 @@
+#include "bvh.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "mapped_file.hpp"
+
+namespace raytracing {
+
+static constexpr char cache_magic[8] = {'R', 'T', 'B', 'V', 'H', '0', '0', '1'};
+
+struct CacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint64_t node_count;
+    uint64_t ref_count;
+    int64_t root;
+};
+
+void Hasher::add(const void *data, size_t size) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        value = (value ^ word) * 0x100000001b3ull;
+    }
+    for (; i < size; ++i) {
+        value = (value ^ bytes[i]) * 0x100000001b3ull;
+    }
+}
+
+void BVH::hash_settings(Hasher &hasher) const {
+    hasher.add(static_cast<int>(method));
+    hasher.add(treelet_passes);
+    hasher.add(duplication_budget);
+}
+
+uint64_t BVH::geometry_hash(const std::vector<Geometry> &primitives) const {
+    Hasher hasher;
+    hash_settings(hasher);
+    hasher.add(primitives.size());
+    for (auto &obj : primitives) {
+        hasher.add(static_cast<int>(obj.shape));
+        hasher.add(obj.position);
+        hasher.add(obj.rotation);
+        hasher.add(obj.center);
+        switch (obj.shape) {
+        case Shape::Ellipsoid:
+            hasher.add(obj.ellipsoid_radius);
+            break;
+        case Shape::Box:
+            hasher.add(obj.box_size);
+            break;
+        case Shape::Triangle:
+            hasher.add(obj.tri_A);
+            hasher.add(obj.tri_B);
+            hasher.add(obj.tri_C);
+            break;
+        case Shape::Plane:
+            hasher.add(obj.plane_normal);
+            break;
+        }
+    }
+    return hasher.value;
+}
+
+std::string BVH::cache_path(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(cache_directory) / name).string();
+}
+
+// A cache file must describe a tree traversal can walk: children after their parent and in range, and leaves within
+// the references.
+static bool valid_nodes(const Node *nodes, uint64_t node_count, int64_t root, uint64_t ref_count) {
+    if (node_count == 0) {
+        return root == -1 && ref_count == 0;
+    }
+    if (root < 0 || static_cast<uint64_t>(root) >= node_count) {
+        return false;
+    }
+    for (uint64_t i = 0; i < node_count; ++i) {
+        auto &node = nodes[i];
+        if (node.is_leaf()) {
+            if (node.offset < 0 || node.offset + static_cast<uint64_t>(node.primitive_count) > ref_count) {
+                return false;
+            }
+        } else if (i + 1 >= node_count || static_cast<uint64_t>(node.offset) <= i + 1 ||
+                   static_cast<uint64_t>(node.offset) >= node_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BVH::load(const std::string &fp, uint64_t key, size_t primitive_count) {
+    MappedFile file(fp);
+    if (!file.valid() || file.size() < sizeof(CacheHeader)) {
+        return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    size_t payload = file.size() - sizeof(CacheHeader);
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.key != key ||
+        header.node_count > static_cast<uint64_t>(std::numeric_limits<int>::max()) ||
+        header.ref_count > static_cast<uint64_t>(std::numeric_limits<int>::max()) ||
+        payload != header.node_count * sizeof(Node) + header.ref_count * sizeof(int32_t)) {
+        return false;
+    }
+
+    decltype(nodes) loaded(header.node_count);
+    std::memcpy(loaded.data(), file.data() + sizeof(CacheHeader), header.node_count * sizeof(Node));
+    if (!valid_nodes(loaded.data(), header.node_count, header.root, header.ref_count)) {
+        return false;
+    }
+
+    const char *indices_data = file.data() + sizeof(CacheHeader) + header.node_count * sizeof(Node);
+    std::vector<int> indices(header.ref_count);
+    for (uint64_t i = 0; i < header.ref_count; ++i) {
+        int32_t index;
+        std::memcpy(&index, indices_data + i * sizeof(index), sizeof(index));
+        if (index < 0 || static_cast<size_t>(index) >= primitive_count) {
+            return false;
+        }
+        indices[i] = index;
+    }
+
+    nodes.swap(loaded);
+    root = header.root;
+    references.swap(indices);
+    return true;
+}
+
+// A cache that can't be written only costs the next run a build, so failures are reported and the render goes on.
+void BVH::save(const std::string &fp, uint64_t key) const {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(fp).parent_path(), error);
+    std::string tmp = fp + ".tmp";
+    bool written = false;
+    if (!error) {
+        std::ofstream file(tmp, std::ios::binary);
+        CacheHeader header;
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.key = key;
+        header.node_count = nodes.size();
+        header.ref_count = references.size();
+        header.root = root;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(nodes.data()), nodes.size() * sizeof(Node));
+        std::vector<int32_t> indices(references.begin(), references.end());
+        file.write(reinterpret_cast<const char *>(indices.data()), indices.size() * sizeof(int32_t));
+        file.close();
+        written = !file.fail();
+    }
+    if (written) {
+        std::filesystem::rename(tmp, fp, error);
+    }
+    if (!written || error) {
+        std::filesystem::remove(tmp, error);
+        std::cerr << "WARNING: Cannot write BVH cache: " << fp << std::endl;
+    }
+}
+
+} // namespace raytracing
@@ -0,0 +1,415 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <queue>
+#include <stdexcept>
+
+namespace raytracing {
+
+// Edits work on the flat nodes. The left child of an inner node has to stay at i + 1, so a node that gets a new left
+// child is copied, with the chain of left children above it, to free slots and the chain of its new left child is
+// copied after it; right children are only relinked. Once the SAH cost passes the rebuild threshold the tree is built
+// again.
+
+static AABB merge(const AABB &a, const AABB &b) {
+    AABB result = a;
+    result.extend(b);
+    return result;
+}
+
+static int centroid_axis(const AABB &a, const AABB &b) {
+    glm::vec3 offset = glm::abs((b.min + b.max) - (a.min + a.max));
+    return offset.x > offset.y ? (offset.x > offset.z ? 0 : 2) : (offset.y > offset.z ? 1 : 2);
+}
+
+// Stores the nodes depth-first again and drops the free slots, as the refits expect.
+void BVH::relayout() {
+    if (depth_first) {
+        return;
+    }
+    decltype(nodes) output;
+    output.reserve(nodes.size() - free_nodes.size());
+    if (root != -1) {
+        std::vector<std::pair<int, int>> stack = {{root, -1}};
+        while (!stack.empty()) {
+            auto [i, parent] = stack.back();
+            stack.pop_back();
+
+            if (parent != -1) {
+                output[parent].offset = output.size();
+            }
+            output.push_back(nodes[i]);
+            if (!nodes[i].is_leaf()) {
+                stack.push_back({nodes[i].offset, static_cast<int>(output.size()) - 1});
+                stack.push_back({i + 1, -1});
+            }
+        }
+        root = 0;
+    }
+    nodes.swap(output);
+    parents.clear();
+    free_nodes.clear();
+    depth_first = true;
+}
+
+void BVH::begin_edit() {
+    if (!depth_first) {
+        return;
+    }
+    depth_first = false;
+    parents.assign(nodes.size(), -1);
+    free_nodes.clear();
+    edit_cost = 0.0;
+    std::vector<int> stack;
+    if (root != -1) {
+        stack.push_back(root);
+    }
+    while (!stack.empty()) {
+        int i = stack.back();
+        stack.pop_back();
+        edit_cost += node_cost(nodes[i]);
+        if (!nodes[i].is_leaf()) {
+            parents[i + 1] = parents[nodes[i].offset] = i;
+            stack.push_back(i + 1);
+            stack.push_back(nodes[i].offset);
+        }
+    }
+}
+
+// Consecutive slots for a chain of count nodes, from the end of the free list when its last entries are consecutive.
+int BVH::allocate_nodes(int count) {
+    int n = free_nodes.size();
+    if (n >= count) {
+        int first = free_nodes[n - count];
+        bool consecutive = true;
+        for (int k = 1; k < count; ++k) {
+            consecutive = consecutive && free_nodes[n - count + k] == first + k;
+        }
+        if (consecutive) {
+            free_nodes.resize(n - count);
+            return first;
+        }
+    }
+    int first = nodes.size();
+    nodes.resize(first + count);
+    parents.resize(first + count, -1);
+    return first;
+}
+
+void BVH::free_node(int i) {
+    nodes[i] = Node();
+    parents[i] = -1;
+    free_nodes.push_back(i);
+}
+
+void BVH::set_aabb(int i, const AABB &aabb) {
+    edit_cost -= node_cost(nodes[i]);
+    nodes[i].aabb = aabb;
+    edit_cost += node_cost(nodes[i]);
+}
+
+// Makes a and b the children of inner node i and returns the slot i ends up in. The node previously in the left slot
+// of i has to be linked elsewhere by the caller.
+int BVH::set_children(int i, int a, int b) {
+    if (b == i + 1) {
+        std::swap(a, b);
+    }
+    if (a == i + 1) {
+        nodes[i].offset = b;
+        parents[a] = parents[b] = i;
+        return i;
+    }
+
+    std::vector<int> chain = {i};
+    while (parents[chain.back()] != -1 && parents[chain.back()] + 1 == chain.back()) {
+        chain.push_back(parents[chain.back()]);
+    }
+    std::reverse(chain.begin(), chain.end());
+    int head_parent = parents[chain.front()];
+    int moved = chain.size() - 1;
+    for (int j = a;; ++j) {
+        chain.push_back(j);
+        if (nodes[j].is_leaf()) {
+            break;
+        }
+    }
+
+    int first = allocate_nodes(chain.size());
+    for (int k = 0; k < static_cast<int>(chain.size()); ++k) {
+        int slot = first + k;
+        nodes[slot] = nodes[chain[k]];
+        parents[slot] = k == 0 ? head_parent : slot - 1;
+        if (!nodes[slot].is_leaf()) {
+            parents[nodes[slot].offset] = slot;
+        }
+        free_node(chain[k]);
+    }
+    moved += first;
+    nodes[moved].offset = b;
+    parents[b] = moved;
+    if (head_parent == -1) {
+        root = first;
+    } else {
+        nodes[head_parent].offset = first;
+    }
+    return moved;
+}
+
+// Branch and bound search for the sibling that adds the least surface area to the tree, as in the insertion of
+// Bittner et al., followed by local rotations on the path back to the root.
+void BVH::insert_leaf(const Node &leaf) {
+    edit_cost += node_cost(leaf);
+    if (root == -1) {
+        root = allocate_nodes(1);
+        nodes[root] = leaf;
+        return;
+    }
+
+    float area = leaf.aabb.S();
+    int best = root;
+    float best_cost = merge(nodes[root].aabb, leaf.aabb).S();
+    std::priority_queue<std::pair<float, int>, std::vector<std::pair<float, int>>, std::greater<>> queue;
+    queue.push({0.f, root});
+    while (!queue.empty()) {
+        auto [inherited, i] = queue.top();
+        queue.pop();
+        if (inherited + area >= best_cost) {
+            break;
+        }
+        auto &node = nodes[i];
+        float direct = merge(node.aabb, leaf.aabb).S();
+        if (inherited + direct < best_cost) {
+            best_cost = inherited + direct;
+            best = i;
+        }
+        float child_inherited = inherited + direct - node.aabb.S();
+        if (!node.is_leaf() && child_inherited + area < best_cost) {
+            queue.push({child_inherited, i + 1});
+            queue.push({child_inherited, node.offset});
+        }
+    }
+
+    int parent = parents[best];
+    int i = allocate_nodes(2);
+    nodes[i].aabb = merge(nodes[best].aabb, leaf.aabb);
+    nodes[i].offset = best;
+    nodes[i].split_axis = centroid_axis(nodes[best].aabb, leaf.aabb);
+    nodes[i + 1] = leaf;
+    parents[i + 1] = parents[best] = i;
+    edit_cost += node_cost(nodes[i]);
+    if (parent == -1) {
+        root = i;
+        parents[i] = -1;
+    } else {
+        set_children(parent, i, nodes[parent].offset == best ? parent + 1 : nodes[parent].offset);
+    }
+    refit_upwards(parents[best], true);
+}
+
+// Swaps a child of i with a grandchild under its sibling when that shrinks the sibling, as in Kopta et al. Returns the
+// slot i ends up in.
+int BVH::rotate(int i) {
+    float best_gain = 0.f;
+    int best_child = -1;
+    int best_other = -1;
+    int best_grandchild = -1;
+    int best_kept = -1;
+    for (auto [child, other] : {std::pair{i + 1, nodes[i].offset}, std::pair{nodes[i].offset, i + 1}}) {
+        auto &other_node = nodes[other];
+        if (other_node.is_leaf()) {
+            continue;
+        }
+        for (auto [grandchild, kept] : {std::pair{other + 1, other_node.offset}, std::pair{other_node.offset, other + 1}}) {
+            float gain = other_node.aabb.S() - merge(nodes[child].aabb, nodes[kept].aabb).S();
+            if (gain > best_gain) {
+                best_gain = gain;
+                best_child = child;
+                best_other = other;
+                best_grandchild = grandchild;
+                best_kept = kept;
+            }
+        }
+    }
+    if (best_child == -1) {
+        return i;
+    }
+
+    int other = set_children(best_other, best_child, best_kept);
+    set_aabb(other, merge(nodes[other + 1].aabb, nodes[nodes[other].offset].aabb));
+    nodes[other].split_axis = centroid_axis(nodes[other + 1].aabb, nodes[nodes[other].offset].aabb);
+    return set_children(parents[other], best_grandchild, other);
+}
+
+void BVH::refit_upwards(int i, bool rotations) {
+    for (; i != -1; i = parents[i]) {
+        if (rotations) {
+            i = rotate(i);
+        }
+        auto &left = nodes[i + 1].aabb;
+        auto &right = nodes[nodes[i].offset].aabb;
+        set_aabb(i, merge(left, right));
+        nodes[i].split_axis = centroid_axis(left, right);
+    }
+}
+
+// Once most slots are free the nodes are compacted, which costs a constant amount per freed slot.
+void BVH::finish_edit(const std::vector<Geometry> &primitives, int first_changed) {
+    if (sah_cost() > built_sah_cost * rebuild_threshold) {
+        build(primitives);
+        return;
+    }
+    if (free_nodes.size() > nodes.size() / 2) {
+        relayout();
+    }
+    blocks.update(primitives, references, first_changed);
+}
+
+// New primitives are appended and referenced from new leaves, so only their slots of the primitive blocks need to be
+// filled in.
+std::vector<int> BVH::insert(std::vector<Geometry> &primitives, const std::vector<Geometry> &added) {
+    begin_edit();
+    int first_changed = references.size();
+    std::vector<int> ids;
+    for (auto &obj : added) {
+        Node leaf;
+        leaf.aabb.extend(obj);
+        leaf.offset = references.size();
+        leaf.primitive_count = 1;
+        references.push_back(primitives.size());
+        primitives.push_back(obj);
+        primitive_ids.push_back(next_primitive_id);
+        ids.push_back(next_primitive_id++);
+        insert_leaf(leaf);
+    }
+    finish_edit(primitives, first_changed);
+    return ids;
+}
+
+// Removed primitives are squeezed out of the geometry and object arrays and their references out of the leaves, which
+// keeps every leaf's remaining references contiguous. Leaves that become empty are unlinked and their sibling takes the
+// parent's place. Unlinking can move the chain that holds another emptied leaf, so those are tracked by slot, and the
+// paths are only refitted, without the rotations that would move them further.
+void BVH::remove(std::vector<Geometry> &primitives, std::vector<Object> &objects, const std::vector<int> &ids) {
+    std::vector<bool> removed(next_primitive_id, false);
+    for (int id : ids) {
+        if (id < 0 || id >= next_primitive_id) {
+            throw std::runtime_error("unknown primitive id: " + std::to_string(id));
+        }
+        removed[id] = true;
+    }
+
+    int n = primitives.size();
+    std::vector<int> new_indices(n, -1);
+    int kept = 0;
+    for (int i = 0; i < n; ++i) {
+        if (removed[primitive_ids[i]]) {
+            continue;
+        }
+        new_indices[i] = kept;
+        if (kept != i) {
+            primitives[kept] = primitives[i];
+            objects[kept] = objects[i];
+            primitive_ids[kept] = primitive_ids[i];
+        }
+        ++kept;
+    }
+    if (kept == n) {
+        return;
+    }
+    primitives.resize(kept);
+    objects.resize(kept);
+    primitive_ids.resize(kept);
+
+    int n_references = references.size();
+    std::vector<int> new_slots(n_references + 1);
+    int kept_references = 0;
+    int first_changed = n_references;
+    for (int i = 0; i < n_references; ++i) {
+        new_slots[i] = kept_references;
+        int index = new_indices[references[i]];
+        if (index != references[i] || kept_references != i) {
+            first_changed = std::min(first_changed, kept_references);
+        }
+        if (index != -1) {
+            references[kept_references++] = index;
+        }
+    }
+    new_slots[n_references] = kept_references;
+    references.resize(kept_references);
+
+    begin_edit();
+    std::vector<int> emptied;
+    std::vector<bool> pending(nodes.size(), false);
+    for (int i = 0; i < static_cast<int>(nodes.size()); ++i) {
+        auto &node = nodes[i];
+        if (!node.is_leaf()) {
+            continue;
+        }
+        int first = new_slots[node.offset];
+        int count = new_slots[node.offset + node.primitive_count] - first;
+        bool changed = count != static_cast<int>(node.primitive_count);
+        node.offset = first;
+        if (!changed) {
+            continue;
+        }
+        // an emptied leaf keeps its old count, so that it still ends its chain, until it is unlinked
+        if (count == 0) {
+            emptied.push_back(i);
+            pending[i] = true;
+            continue;
+        }
+        edit_cost -= node_cost(node);
+        node.primitive_count = count;
+        node.aabb = AABB();
+        for (int j = first; j < first + count; ++j) {
+            node.aabb.extend(primitives[references[j]]);
+        }
+        edit_cost += node_cost(node);
+        refit_upwards(parents[i], false);
+    }
+
+    while (!emptied.empty()) {
+        int leaf = emptied.back();
+        emptied.pop_back();
+        if (!pending[leaf]) {
+            continue;
+        }
+        pending[leaf] = false;
+        edit_cost -= node_cost(nodes[leaf]);
+        int parent = parents[leaf];
+        if (parent == -1) {
+            free_node(leaf);
+            root = -1;
+            continue;
+        }
+
+        edit_cost -= node_cost(nodes[parent]);
+        int sibling = parent + 1 == leaf ? nodes[parent].offset : parent + 1;
+        int grandparent = parents[parent];
+        if (grandparent == -1) {
+            root = sibling;
+            parents[sibling] = -1;
+        } else {
+            int uncle = grandparent + 1 == parent ? nodes[grandparent].offset : grandparent + 1;
+            int end = sibling;
+            while (!nodes[end].is_leaf()) {
+                ++end;
+            }
+            grandparent = set_children(grandparent, sibling, uncle);
+            pending.resize(nodes.size());
+            int moved = nodes[grandparent].offset == uncle ? grandparent + 1 : sibling;
+            if (moved != sibling && pending[end]) {
+                int moved_end = moved + end - sibling;
+                pending[end] = false;
+                pending[moved_end] = true;
+                emptied.push_back(moved_end);
+            }
+        }
+        free_node(parent);
+        free_node(leaf);
+        refit_upwards(grandparent, false);
+    }
+    finish_edit(primitives, first_changed);
+}
+
+} // namespace raytracing
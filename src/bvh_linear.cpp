@@ -0,0 +1,326 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "thread_pool.hpp"
+
+namespace raytracing {
+
+static constexpr int parallel_grain = 1 << 14;
+static constexpr int max_leaf_size = 4;
+static constexpr int treelet_size = 7;
+static constexpr float traversal_cost = 1.2f;
+static constexpr float intersection_cost = 1.f;
+
+static uint64_t expand_bits(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+static uint64_t morton_code(const glm::vec3 &p, int bits) {
+    float cells = static_cast<float>((1 << bits) - 1);
+    glm::vec3 q = glm::clamp(p * cells, glm::vec3(0.f), glm::vec3(cells));
+    return expand_bits(static_cast<uint64_t>(q.x)) << 2 | expand_bits(static_cast<uint64_t>(q.y)) << 1 | expand_bits(static_cast<uint64_t>(q.z));
+}
+
+static void radix_sort(std::vector<std::pair<uint64_t, int>> &items, int key_bits) {
+    constexpr int digit_bits = 8;
+    constexpr int n_digits = 1 << digit_bits;
+
+    int n = items.size();
+    int n_chunks = (n + parallel_grain - 1) / parallel_grain;
+    std::vector<std::pair<uint64_t, int>> buffer(n);
+    std::vector<int> offsets(n_chunks * n_digits);
+
+    for (int shift = 0; shift < key_bits; shift += digit_bits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_for(0, n_chunks, 1, [&](int chunk, int) {
+            for (int i = chunk * parallel_grain; i < std::min(n, (chunk + 1) * parallel_grain); ++i) {
+                ++offsets[chunk * n_digits + (items[i].first >> shift & (n_digits - 1))];
+            }
+        });
+
+        int offset = 0;
+        for (int digit = 0; digit < n_digits; ++digit) {
+            for (int chunk = 0; chunk < n_chunks; ++chunk) {
+                int size = offsets[chunk * n_digits + digit];
+                offsets[chunk * n_digits + digit] = offset;
+                offset += size;
+            }
+        }
+
+        parallel_for(0, n_chunks, 1, [&](int chunk, int) {
+            int *chunk_offsets = &offsets[chunk * n_digits];
+            for (int i = chunk * parallel_grain; i < std::min(n, (chunk + 1) * parallel_grain); ++i) {
+                buffer[chunk_offsets[items[i].first >> shift & (n_digits - 1)]++] = items[i];
+            }
+        });
+        items.swap(buffer);
+    }
+}
+
+// Internal nodes are [0, n - 1), leaves are [n - 1, 2n - 1), the root is node 0.
+struct LinearNode {
+    AABB aabb;
+    int children[2] = {-1, -1};
+    int parent = -1;
+    int count = 1;
+    float cost = 0.f;
+};
+
+struct LinearTree {
+    std::vector<LinearNode> nodes;
+    int n_leaves;
+
+    bool is_leaf(int i) const { return i >= n_leaves - 1; }
+
+    void update(int i) {
+        auto &node = nodes[i];
+        auto &l = nodes[node.children[0]];
+        auto &r = nodes[node.children[1]];
+        node.aabb = l.aabb;
+        node.aabb.extend(r.aabb);
+        node.count = l.count + r.count;
+        node.cost = traversal_cost * node.aabb.S() + l.cost + r.cost;
+    }
+
+    void restructure(int root);
+    int assign(int subset, const int *leaves, const int *partitions, const int *free_nodes, int &n_free, int parent);
+};
+
+void LinearTree::restructure(int root) {
+    int leaves[treelet_size] = {nodes[root].children[0], nodes[root].children[1]};
+    int free_nodes[treelet_size];
+    int n = 2;
+    int n_free = 0;
+    while (n < treelet_size) {
+        int best = -1;
+        for (int i = 0; i < n; ++i) {
+            if (!is_leaf(leaves[i]) && (best == -1 || nodes[leaves[i]].aabb.S() > nodes[leaves[best]].aabb.S())) {
+                best = i;
+            }
+        }
+        if (best == -1) {
+            break;
+        }
+        int expanded = leaves[best];
+        free_nodes[n_free++] = expanded;
+        leaves[best] = nodes[expanded].children[0];
+        leaves[n++] = nodes[expanded].children[1];
+    }
+
+    if (n < 3) {
+        return;
+    }
+
+    int n_subsets = 1 << n;
+    float costs[1 << treelet_size];
+    int partitions[1 << treelet_size];
+    AABB aabbs[1 << treelet_size];
+    for (int subset = 1; subset < n_subsets; ++subset) {
+        int lowest = __builtin_ctz(subset);
+        aabbs[subset] = aabbs[subset & (subset - 1)];
+        aabbs[subset].extend(nodes[leaves[lowest]].aabb);
+        if ((subset & (subset - 1)) == 0) {
+            costs[subset] = nodes[leaves[lowest]].cost;
+        }
+    }
+
+    for (int size = 2; size <= n; ++size) {
+        for (int subset = 1; subset < n_subsets; ++subset) {
+            if (__builtin_popcount(subset) != size) {
+                continue;
+            }
+            float best_cost = std::numeric_limits<float>::infinity();
+            int lowest = subset & -subset;
+            for (int part = (subset - 1) & subset; part != 0; part = (part - 1) & subset) {
+                if ((part & lowest) == 0) {
+                    continue;
+                }
+                float cost = costs[part] + costs[subset ^ part];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    partitions[subset] = part;
+                }
+            }
+            costs[subset] = traversal_cost * aabbs[subset].S() + best_cost;
+        }
+    }
+
+    int full = n_subsets - 1;
+    if (costs[full] >= nodes[root].cost * 0.999f) {
+        return;
+    }
+
+    int part = partitions[full];
+    nodes[root].children[0] = assign(part, leaves, partitions, free_nodes, n_free, root);
+    nodes[root].children[1] = assign(full ^ part, leaves, partitions, free_nodes, n_free, root);
+    update(root);
+}
+
+int LinearTree::assign(int subset, const int *leaves, const int *partitions, const int *free_nodes, int &n_free, int parent) {
+    if ((subset & (subset - 1)) == 0) {
+        int leaf = leaves[__builtin_ctz(subset)];
+        nodes[leaf].parent = parent;
+        return leaf;
+    }
+    int i = free_nodes[--n_free];
+    int part = partitions[subset];
+    nodes[i].parent = parent;
+    nodes[i].children[0] = assign(part, leaves, partitions, free_nodes, n_free, i);
+    nodes[i].children[1] = assign(subset ^ part, leaves, partitions, free_nodes, n_free, i);
+    update(i);
+    return i;
+}
+
+void BVH::build_linear(std::vector<PrimitiveRef> &refs) {
+    int n = refs.size();
+    nodes.clear();
+    root = -1;
+    if (n == 0) {
+        return;
+    }
+
+    AABB centroid_aabb;
+    for (auto &ref : refs) {
+        centroid_aabb.extend(ref.center);
+    }
+    glm::vec3 extent = glm::max(centroid_aabb.max - centroid_aabb.min, glm::vec3(std::numeric_limits<float>::min()));
+
+    int bits = n > (1 << 20) ? 21 : 10;
+    std::vector<std::pair<uint64_t, int>> codes(n);
+    parallel_for(0, n, parallel_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            codes[i] = {morton_code((refs[i].center - centroid_aabb.min) / extent, bits), i};
+        }
+    });
+    radix_sort(codes, 3 * bits);
+
+    auto delta = [&](int i, int j) {
+        if (j < 0 || j >= n) {
+            return -1;
+        }
+        if (codes[i].first == codes[j].first) {
+            return 64 + __builtin_clz(static_cast<uint32_t>(i ^ j));
+        }
+        return __builtin_clzll(codes[i].first ^ codes[j].first);
+    };
+
+    LinearTree tree;
+    tree.n_leaves = n;
+    tree.nodes.resize(2 * n - 1);
+
+    parallel_for(0, n - 1, parallel_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+            int delta_min = delta(i, i - d);
+            int l_max = 2;
+            while (delta(i, i + l_max * d) > delta_min) {
+                l_max *= 2;
+            }
+            int l = 0;
+            for (int t = l_max / 2; t >= 1; t /= 2) {
+                if (delta(i, i + (l + t) * d) > delta_min) {
+                    l += t;
+                }
+            }
+            int j = i + l * d;
+            int delta_node = delta(i, j);
+            int s = 0;
+            int t = l;
+            do {
+                t = (t + 1) / 2;
+                if (delta(i, i + (s + t) * d) > delta_node) {
+                    s += t;
+                }
+            } while (t > 1);
+            int split = i + s * d + std::min(d, 0);
+
+            int left = std::min(i, j) == split ? n - 1 + split : split;
+            int right = std::max(i, j) == split + 1 ? n - 1 + split + 1 : split + 1;
+            tree.nodes[i].children[0] = left;
+            tree.nodes[i].children[1] = right;
+            tree.nodes[left].parent = i;
+            tree.nodes[right].parent = i;
+        }
+    });
+
+    parallel_for(0, n, parallel_grain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            auto &leaf = tree.nodes[n - 1 + i];
+            leaf.aabb = refs[codes[i].second].aabb;
+            leaf.cost = intersection_cost * leaf.aabb.S();
+        }
+    });
+
+    for (int pass = 0; pass <= treelet_passes; ++pass) {
+        bool optimize = pass > 0;
+        std::vector<std::atomic_int> visits(n - 1);
+        parallel_for(n - 1, 2 * n - 1, parallel_grain, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                int parent = tree.nodes[i].parent;
+                while (parent != -1 && visits[parent].fetch_add(1, std::memory_order_acq_rel) == 1) {
+                    tree.update(parent);
+                    if (optimize && tree.nodes[parent].count >= treelet_size) {
+                        tree.restructure(parent);
+                    }
+                    parent = tree.nodes[parent].parent;
+                }
+            }
+        });
+    }
+
+    std::vector<PrimitiveRef> ordered;
+    ordered.reserve(n);
+    nodes.reserve(2 * n - 1);
+    std::vector<std::pair<int, int *>> stack = {{0, nullptr}};
+    while (!stack.empty()) {
+        auto [i, parent_link] = stack.back();
+        stack.pop_back();
+
+        auto &linear_node = tree.nodes[i];
+        Node result;
+        result.aabb = linear_node.aabb;
+
+        int result_i = nodes.size();
+        if (parent_link != nullptr) {
+            *parent_link = result_i;
+        }
+
+        if (tree.is_leaf(i) || linear_node.count <= max_leaf_size) {
+            result.offset = ordered.size();
+            result.primitive_count = linear_node.count;
+            std::vector<int> subtree = {i};
+            while (!subtree.empty()) {
+                int j = subtree.back();
+                subtree.pop_back();
+                if (tree.is_leaf(j)) {
+                    ordered.push_back(refs[codes[j - (n - 1)].second]);
+                } else {
+                    subtree.push_back(tree.nodes[j].children[1]);
+                    subtree.push_back(tree.nodes[j].children[0]);
+                }
+            }
+            nodes.push_back(result);
+            continue;
+        }
+
+        glm::vec3 offset = glm::abs((tree.nodes[linear_node.children[1]].aabb.min + tree.nodes[linear_node.children[1]].aabb.max) -
+                                    (tree.nodes[linear_node.children[0]].aabb.min + tree.nodes[linear_node.children[0]].aabb.max));
+        result.split_axis = offset.x > offset.y ? (offset.x > offset.z ? 0 : 2) : (offset.y > offset.z ? 1 : 2);
+        nodes.push_back(result);
+        stack.push_back({linear_node.children[1], &nodes[result_i].offset});
+        stack.push_back({linear_node.children[0], nullptr});
+    }
+
+    refs.swap(ordered);
+    root = 0;
+}
+
+} // namespace raytracing
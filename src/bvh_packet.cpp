@@ -0,0 +1,148 @@
+#include "packet.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+namespace raytracing {
+
+template <int N> RayPacket<N>::RayPacket(const Ray *rays, int n, const float *distances) {
+    static_assert(N % 4 == 0);
+    active = 0;
+    coherent = true;
+    pos_min = inv_dir_min = glm::vec3(std::numeric_limits<float>::infinity());
+    pos_max = inv_dir_max = glm::vec3(-std::numeric_limits<float>::infinity());
+    for (int k = 0; k < N; ++k) {
+        if (k >= n) {
+            for (int axis = 0; axis < 3; ++axis) {
+                pos[axis][k] = 0.f;
+                inv_dir[axis][k] = 1.f;
+            }
+            max_distance[k] = -std::numeric_limits<float>::infinity();
+            continue;
+        }
+        glm::vec3 d = 1.f / rays[k].dir;
+        for (int axis = 0; axis < 3; ++axis) {
+            pos[axis][k] = rays[k].pos[axis];
+            inv_dir[axis][k] = d[axis];
+            if (k == 0) {
+                sign[axis] = d[axis] < 0;
+            }
+            coherent = coherent && sign[axis] == (d[axis] < 0);
+        }
+        pos_min = glm::min(pos_min, rays[k].pos);
+        pos_max = glm::max(pos_max, rays[k].pos);
+        inv_dir_min = glm::min(inv_dir_min, d);
+        inv_dir_max = glm::max(inv_dir_max, d);
+        max_distance[k] = distances[k];
+        active |= 1 << k;
+    }
+}
+
+template <int N> int RayPacket<N>::intersect(const AABB &aabb, int mask) const {
+    if (coherent) {
+        float t_near = 0.f;
+        float t_far = -std::numeric_limits<float>::infinity();
+        for (int k = 0; k < N; ++k) {
+            t_far = std::max(t_far, max_distance[k]);
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            const glm::vec3 *bounds = &aabb.min;
+            float near = bounds[sign[axis]][axis];
+            float far = bounds[1 - sign[axis]][axis];
+            float near_lo = near - pos_max[axis];
+            float near_hi = near - pos_min[axis];
+            float far_lo = far - pos_max[axis];
+            float far_hi = far - pos_min[axis];
+            t_near = std::max(t_near, std::min({near_lo * inv_dir_min[axis], near_lo * inv_dir_max[axis], near_hi * inv_dir_min[axis],
+                                                near_hi * inv_dir_max[axis]}));
+            t_far = std::min(t_far, std::max({far_lo * inv_dir_min[axis], far_lo * inv_dir_max[axis], far_hi * inv_dir_min[axis],
+                                              far_hi * inv_dir_max[axis]}));
+        }
+        if (t_near > t_far) {
+            return 0;
+        }
+    }
+
+    int result = 0;
+#if defined(__SSE__)
+    for (int g = 0; g < N; g += 4) {
+        __m128 t_near = _mm_setzero_ps();
+        __m128 t_far = _mm_load_ps(max_distance + g);
+        for (int axis = 0; axis < 3; ++axis) {
+            __m128 p = _mm_load_ps(pos[axis] + g);
+            __m128 inv_d = _mm_load_ps(inv_dir[axis] + g);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.min[axis]), p), inv_d);
+            __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.max[axis]), p), inv_d);
+            t_near = _mm_max_ps(_mm_min_ps(t1, t2), t_near);
+            t_far = _mm_min_ps(_mm_max_ps(t1, t2), t_far);
+        }
+        result |= _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) << g;
+    }
+#else
+    for (int k = 0; k < N; ++k) {
+        float t_near = 0.f;
+        float t_far = max_distance[k];
+        for (int axis = 0; axis < 3; ++axis) {
+            float t1 = (aabb.min[axis] - pos[axis][k]) * inv_dir[axis][k];
+            float t2 = (aabb.max[axis] - pos[axis][k]) * inv_dir[axis][k];
+            t_near = std::max(std::min(t1, t2), t_near);
+            t_far = std::min(std::max(t1, t2), t_far);
+        }
+        result |= (t_near <= t_far) << k;
+    }
+#endif
+    return result & mask;
+}
+
+template <int N>
+void intersect_packet(const BVH &bvh,
+                      const std::vector<Object> &primitives,
+                      const Ray *rays,
+                      int n,
+                      std::pair<OptInsc, const Object *> *nearest,
+                      float *max_distance) {
+    if (bvh.root == -1) {
+        return;
+    }
+
+    RayPacket<N> packet(rays, n, max_distance);
+    TraversalStack<std::pair<int, int>> stack;
+    stack.push({bvh.root, packet.active});
+    while (stack.size > 0) {
+        auto [i, mask] = stack.pop();
+        auto &node = bvh.nodes[i];
+        mask = packet.intersect(node.aabb, mask);
+        if (mask == 0) {
+            continue;
+        }
+
+        if (node.is_leaf()) {
+            for (int k = 0; k < n; ++k) {
+                if (mask >> k & 1) {
+                    intersect_primitives(primitives, bvh.blocks, node.offset, node.primitive_count, rays[k], nearest[k], max_distance[k]);
+                    packet.max_distance[k] = max_distance[k];
+                }
+            }
+            continue;
+        }
+
+        int left = i + 1;
+        int right = node.offset;
+        int axis = node.split_axis;
+        int first_lane = __builtin_ctz(mask);
+        float left_center = bvh.nodes[left].aabb.min[axis] + bvh.nodes[left].aabb.max[axis];
+        float right_center = bvh.nodes[right].aabb.min[axis] + bvh.nodes[right].aabb.max[axis];
+        bool left_first = (left_center <= right_center) == (packet.inv_dir[axis][first_lane] >= 0.f);
+        stack.push({left_first ? right : left, mask});
+        stack.push({left_first ? left : right, mask});
+    }
+}
+
+template void intersect_packet<4>(const BVH &, const std::vector<Object> &, const Ray *, int, std::pair<OptInsc, const Object *> *, float *);
+template void intersect_packet<8>(const BVH &, const std::vector<Object> &, const Ray *, int, std::pair<OptInsc, const Object *> *, float *);
+template void intersect_packet<16>(const BVH &, const std::vector<Object> &, const Ray *, int, std::pair<OptInsc, const Object *> *, float *);
+
+} // namespace raytracing
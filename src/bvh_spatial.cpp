@@ -0,0 +1,298 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+
+namespace raytracing {
+
+static constexpr int max_leaf_size = 4;
+static constexpr int object_bin_count = 16;
+static constexpr int spatial_bin_count = 32;
+static constexpr float min_overlap = 1e-5f;
+
+static AABB intersection(const AABB &x, const AABB &y) {
+    AABB result;
+    result.min = glm::max(x.min, y.min);
+    result.max = glm::min(x.max, y.max);
+    return result;
+}
+
+static AABB clip_triangle(const glm::vec3 *vertices, int axis, float lo, float hi) {
+    glm::vec3 polygon[9], clipped[9];
+    int n = 3;
+    std::copy(vertices, vertices + 3, polygon);
+
+    for (int side = 0; side < 2; ++side) {
+        auto inside = [&](const glm::vec3 &p) { return side == 0 ? p[axis] >= lo : p[axis] <= hi; };
+        float plane = side == 0 ? lo : hi;
+        int m = 0;
+        for (int i = 0; i < n; ++i) {
+            const glm::vec3 &a = polygon[i];
+            const glm::vec3 &b = polygon[(i + 1) % n];
+            if (inside(a)) {
+                clipped[m++] = a;
+            }
+            if (inside(a) != inside(b)) {
+                float t = (plane - a[axis]) / (b[axis] - a[axis]);
+                glm::vec3 p = a + (b - a) * t;
+                p[axis] = plane;
+                clipped[m++] = p;
+            }
+        }
+        n = m;
+        std::copy(clipped, clipped + m, polygon);
+    }
+
+    AABB result;
+    for (int i = 0; i < n; ++i) {
+        result.extend(polygon[i]);
+    }
+    return result;
+}
+
+struct SpatialBuilder {
+    BVH &bvh;
+    const std::vector<Geometry> &primitives;
+    std::vector<PrimitiveRef> &output;
+    int duplicates_left;
+    float min_overlap_area;
+
+    AABB clip(const PrimitiveRef &ref, int axis, float lo, float hi) const {
+        const Geometry &obj = primitives[ref.index];
+        AABB slab = ref.aabb;
+        slab.min[axis] = std::max(slab.min[axis], lo);
+        slab.max[axis] = std::min(slab.max[axis], hi);
+        if (obj.shape != Shape::Triangle) {
+            return slab;
+        }
+        glm::vec3 vertices[3] = {obj.position + obj.rotation * obj.tri_A,
+                                 obj.position + obj.rotation * obj.tri_B,
+                                 obj.position + obj.rotation * obj.tri_C};
+        return intersection(clip_triangle(vertices, axis, lo, hi), slab);
+    }
+
+    int make_leaf(const std::vector<PrimitiveRef> &refs, const AABB &aabb) {
+        BuildNode result;
+        result.aabb = aabb;
+        result.first_primitive_id = output.size();
+        result.primitive_count = refs.size();
+        output.insert(output.end(), refs.begin(), refs.end());
+        bvh.build_nodes.push_back(result);
+        return bvh.build_nodes.size() - 1;
+    }
+
+    int build_node(std::vector<PrimitiveRef> refs);
+};
+
+int SpatialBuilder::build_node(std::vector<PrimitiveRef> refs) {
+    int count = refs.size();
+
+    AABB aabb, centroid_aabb;
+    for (auto &ref : refs) {
+        aabb.extend(ref.aabb);
+        centroid_aabb.extend(ref.center);
+    }
+
+    if (count <= max_leaf_size) {
+        return make_leaf(refs, aabb);
+    }
+
+    float best_score = aabb.S() * count;
+
+    // object split, as in the binned builder
+    glm::vec3 extent = centroid_aabb.max - centroid_aabb.min;
+    glm::vec3 scale = glm::vec3(object_bin_count) / extent;
+    auto get_bin = [&](const PrimitiveRef &ref, int axis) {
+        int bin = static_cast<int>((ref.center[axis] - centroid_aabb.min[axis]) * scale[axis]);
+        return std::clamp(bin, 0, object_bin_count - 1);
+    };
+
+    int object_axis = -1;
+    int object_bin = -1;
+    AABB object_left, object_right;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.f) {
+            continue;
+        }
+        AABB bins[object_bin_count];
+        int sizes[object_bin_count] = {};
+        for (auto &ref : refs) {
+            int bin = get_bin(ref, axis);
+            bins[bin].extend(ref.aabb);
+            ++sizes[bin];
+        }
+
+        AABB right_aabbs[object_bin_count];
+        int right_sizes[object_bin_count];
+        AABB right;
+        int size = 0;
+        for (int bin = object_bin_count - 1; bin > 0; --bin) {
+            right.extend(bins[bin]);
+            size += sizes[bin];
+            right_aabbs[bin] = right;
+            right_sizes[bin] = size;
+        }
+
+        AABB left;
+        size = 0;
+        for (int bin = 0; bin < object_bin_count - 1; ++bin) {
+            left.extend(bins[bin]);
+            size += sizes[bin];
+            if (size == 0 || size == count) {
+                continue;
+            }
+            float score = left.S() * size + right_aabbs[bin + 1].S() * right_sizes[bin + 1];
+            if (score < best_score) {
+                best_score = score;
+                object_axis = axis;
+                object_bin = bin;
+                object_left = left;
+                object_right = right_aabbs[bin + 1];
+            }
+        }
+    }
+
+    // spatial split, only worth trying when the object split children overlap
+    int spatial_axis = -1;
+    float spatial_position = 0.f;
+    if (duplicates_left > 0 && (object_axis == -1 || intersection(object_left, object_right).S() > min_overlap_area)) {
+        glm::vec3 node_extent = aabb.max - aabb.min;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (node_extent[axis] <= 0.f) {
+                continue;
+            }
+            float bin_size = node_extent[axis] / spatial_bin_count;
+            auto position_bin = [&](float x) {
+                return std::clamp(static_cast<int>((x - aabb.min[axis]) / bin_size), 0, spatial_bin_count - 1);
+            };
+
+            AABB bins[spatial_bin_count];
+            int entries[spatial_bin_count] = {};
+            int exits[spatial_bin_count] = {};
+            for (auto &ref : refs) {
+                int first_bin = position_bin(ref.aabb.min[axis]);
+                int last_bin = position_bin(ref.aabb.max[axis]);
+                ++entries[first_bin];
+                ++exits[last_bin];
+                if (first_bin == last_bin) {
+                    bins[first_bin].extend(ref.aabb);
+                    continue;
+                }
+                for (int bin = first_bin; bin <= last_bin; ++bin) {
+                    float lo = aabb.min[axis] + bin * bin_size;
+                    float hi = bin == spatial_bin_count - 1 ? aabb.max[axis] : lo + bin_size;
+                    bins[bin].extend(clip(ref, axis, lo, hi));
+                }
+            }
+
+            AABB right_aabbs[spatial_bin_count];
+            int right_sizes[spatial_bin_count];
+            AABB right;
+            int size = 0;
+            for (int bin = spatial_bin_count - 1; bin > 0; --bin) {
+                right.extend(bins[bin]);
+                size += exits[bin];
+                right_aabbs[bin] = right;
+                right_sizes[bin] = size;
+            }
+
+            AABB left;
+            size = 0;
+            for (int bin = 0; bin < spatial_bin_count - 1; ++bin) {
+                left.extend(bins[bin]);
+                size += entries[bin];
+                if (size == 0 || right_sizes[bin + 1] == 0) {
+                    continue;
+                }
+                float score = left.S() * size + right_aabbs[bin + 1].S() * right_sizes[bin + 1];
+                if (score < best_score) {
+                    best_score = score;
+                    spatial_axis = axis;
+                    spatial_position = aabb.min[axis] + (bin + 1) * bin_size;
+                }
+            }
+        }
+    }
+
+    std::vector<PrimitiveRef> left_refs, right_refs;
+    int split_axis;
+    if (spatial_axis != -1) {
+        split_axis = spatial_axis;
+        for (auto &ref : refs) {
+            if (ref.aabb.max[split_axis] <= spatial_position) {
+                left_refs.push_back(ref);
+            } else if (ref.aabb.min[split_axis] >= spatial_position) {
+                right_refs.push_back(ref);
+            } else if (duplicates_left > 0) {
+                --duplicates_left;
+                PrimitiveRef left_ref = ref;
+                PrimitiveRef right_ref = ref;
+                left_ref.aabb = clip(ref, split_axis, -std::numeric_limits<float>::infinity(), spatial_position);
+                right_ref.aabb = clip(ref, split_axis, spatial_position, std::numeric_limits<float>::infinity());
+                left_ref.center = (left_ref.aabb.min + left_ref.aabb.max) * 0.5f;
+                right_ref.center = (right_ref.aabb.min + right_ref.aabb.max) * 0.5f;
+                bool left_empty = glm::any(glm::greaterThan(left_ref.aabb.min, left_ref.aabb.max));
+                bool right_empty = glm::any(glm::greaterThan(right_ref.aabb.min, right_ref.aabb.max));
+                if (!left_empty) {
+                    left_refs.push_back(left_empty || right_empty ? ref : left_ref);
+                }
+                if (!right_empty) {
+                    right_refs.push_back(left_empty || right_empty ? ref : right_ref);
+                }
+                if (left_empty || right_empty) {
+                    ++duplicates_left;
+                }
+            } else if (ref.center[split_axis] < spatial_position) {
+                left_refs.push_back(ref);
+            } else {
+                right_refs.push_back(ref);
+            }
+        }
+    } else if (object_axis != -1) {
+        split_axis = object_axis;
+        for (auto &ref : refs) {
+            (get_bin(ref, object_axis) <= object_bin ? left_refs : right_refs).push_back(ref);
+        }
+    } else {
+        return make_leaf(refs, aabb);
+    }
+
+    if (left_refs.empty() || right_refs.empty()) {
+        return make_leaf(refs, aabb);
+    }
+    refs.clear();
+    refs.shrink_to_fit();
+
+    BuildNode result;
+    result.aabb = aabb;
+    result.split_axis = split_axis;
+    bvh.build_nodes.push_back(result);
+    int result_i = bvh.build_nodes.size() - 1;
+
+    int left = build_node(std::move(left_refs));
+    int right = build_node(std::move(right_refs));
+    bvh.build_nodes[result_i].left_child = left;
+    bvh.build_nodes[result_i].right_child = right;
+
+    return result_i;
+}
+
+void BVH::build_spatial(std::vector<PrimitiveRef> &refs, const std::vector<Geometry> &primitives) {
+    build_nodes.clear();
+    root = -1;
+    if (!refs.empty()) {
+        AABB aabb;
+        for (auto &ref : refs) {
+            aabb.extend(ref.aabb);
+        }
+        std::vector<PrimitiveRef> output;
+        SpatialBuilder builder{*this, primitives, output, static_cast<int>(refs.size() * duplication_budget), min_overlap * aabb.S()};
+        root = builder.build_node(refs);
+        refs.swap(output);
+    }
+
+    flatten();
+    build_nodes.clear();
+    build_nodes.shrink_to_fit();
+}
+
+} // namespace raytracing
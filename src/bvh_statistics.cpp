@@ -0,0 +1,166 @@
+#include "bvh_statistics.hpp"
+
+namespace raytracing {
+
+static const char *method_name(BuildMethod method) {
+    switch (method) {
+    case BuildMethod::Sweep:
+        return "SWEEP";
+    case BuildMethod::Binned:
+        return "BINNED";
+    case BuildMethod::Linear:
+        return "LINEAR";
+    case BuildMethod::Spatial:
+        return "SPATIAL";
+    }
+    return "UNKNOWN";
+}
+
+// Shape and node memory of the tree; the caller fills in what its primitives take.
+BVHStatistics collect_statistics(const BVH &bvh) {
+    BVHStatistics result;
+    result.method = method_name(bvh.method);
+    result.primitive_count = bvh.references.size();
+    result.sah_cost = bvh.sah_cost();
+    result.node_bytes = bvh.nodes.size() * sizeof(Node);
+    result.reference_bytes = bvh.references.size() * sizeof(int);
+    result.block_bytes = bvh.blocks.memory_footprint();
+    if (bvh.root == -1) {
+        return result;
+    }
+
+    float root_area = bvh.nodes[bvh.root].aabb.S();
+    double depth_sum = 0.0;
+    double child_overlap_sum = 0.0;
+    std::vector<std::pair<int, int>> stack = {{bvh.root, 0}};
+    while (!stack.empty()) {
+        auto [i, depth] = stack.back();
+        stack.pop_back();
+
+        auto &node = bvh.nodes[i];
+        ++result.node_count;
+        result.max_depth = std::max(result.max_depth, depth);
+        if (node.is_leaf()) {
+            ++result.leaf_count;
+            depth_sum += depth;
+            if (static_cast<int>(result.depth_histogram.size()) <= depth) {
+                result.depth_histogram.resize(depth + 1);
+            }
+            ++result.depth_histogram[depth];
+            if (result.leaf_size_histogram.size() <= node.primitive_count) {
+                result.leaf_size_histogram.resize(node.primitive_count + 1);
+            }
+            ++result.leaf_size_histogram[node.primitive_count];
+            continue;
+        }
+
+        ++result.inner_count;
+        auto &left = bvh.nodes[i + 1].aabb;
+        auto &right = bvh.nodes[node.offset].aabb;
+        AABB overlap;
+        overlap.min = glm::max(left.min, right.min);
+        overlap.max = glm::min(left.max, right.max);
+        float overlap_area = glm::all(glm::lessThanEqual(overlap.min, overlap.max)) ? overlap.S() : 0.f;
+        if (root_area > 0.f) {
+            result.overlap += overlap_area / root_area;
+        }
+        if (node.aabb.S() > 0.f) {
+            child_overlap_sum += overlap_area / node.aabb.S();
+        }
+        stack.push_back({node.offset, depth + 1});
+        stack.push_back({i + 1, depth + 1});
+    }
+    result.average_leaf_depth = depth_sum / result.leaf_count;
+    if (result.inner_count > 0) {
+        result.average_child_overlap = child_overlap_sum / result.inner_count;
+    }
+    return result;
+}
+
+BVHStatistics collect_statistics(const BVH &bvh, const std::vector<Geometry> &primitives, const std::vector<Object> &objects) {
+    BVHStatistics result = collect_statistics(bvh);
+    result.unique_primitive_count = primitives.size();
+    result.primitive_bytes = primitives.size() * sizeof(Geometry);
+    result.object_bytes = objects.size() * sizeof(Object);
+    return result;
+}
+
+std::vector<BVHStatistics> collect_statistics(const Scene &scene) {
+    std::vector<BVHStatistics> result = {collect_statistics(scene.bvh, scene.geometry, scene.objects)};
+    result.back().name = "scene";
+    if (scene.tlas.instances.empty()) {
+        return result;
+    }
+
+    result.push_back(collect_statistics(scene.tlas.bvh));
+    result.back().name = "tlas";
+    // The TLAS and the meshes reorder their instances and triangles to the leaf order and drop the references.
+    result.back().primitive_count = result.back().unique_primitive_count = scene.tlas.instances.size();
+    result.back().primitive_bytes = scene.tlas.instances.size() * sizeof(Instance);
+    for (size_t i = 0; i < scene.tlas.groups.size(); ++i) {
+        auto &group = scene.tlas.groups[i];
+        std::string name = "group " + (group.name.empty() ? std::to_string(i) : group.name);
+        if (!group.geometry.empty()) {
+            result.push_back(collect_statistics(group.bvh, group.geometry, group.objects));
+            result.back().name = name;
+        }
+        for (size_t j = 0; j < group.meshes.size(); ++j) {
+            auto &mesh = group.meshes[j];
+            result.push_back(collect_statistics(mesh.bvh));
+            result.back().name = name + " mesh " + std::to_string(j);
+            result.back().primitive_count = result.back().unique_primitive_count = mesh.triangles.size();
+            result.back().primitive_bytes = mesh.memory_footprint() - result.back().node_bytes;
+            result.back().object_bytes = sizeof(Object);
+        }
+    }
+    return result;
+}
+
+static void write_array(std::ostream &out, const std::vector<int> &values) {
+    out << "[";
+    for (size_t i = 0; i < values.size(); ++i) {
+        out << (i > 0 ? ", " : "") << values[i];
+    }
+    out << "]";
+}
+
+static void write_entry(std::ostream &out, const BVHStatistics &statistics) {
+    out << "  {\n";
+    out << "    \"name\": \"" << statistics.name << "\",\n";
+    out << "    \"method\": \"" << statistics.method << "\",\n";
+    out << "    \"node_count\": " << statistics.node_count << ",\n";
+    out << "    \"inner_count\": " << statistics.inner_count << ",\n";
+    out << "    \"leaf_count\": " << statistics.leaf_count << ",\n";
+    out << "    \"primitive_count\": " << statistics.primitive_count << ",\n";
+    out << "    \"unique_primitive_count\": " << statistics.unique_primitive_count << ",\n";
+    out << "    \"max_depth\": " << statistics.max_depth << ",\n";
+    out << "    \"average_leaf_depth\": " << statistics.average_leaf_depth << ",\n";
+    out << "    \"depth_histogram\": ";
+    write_array(out, statistics.depth_histogram);
+    out << ",\n";
+    out << "    \"leaf_size_histogram\": ";
+    write_array(out, statistics.leaf_size_histogram);
+    out << ",\n";
+    out << "    \"sah_cost\": " << statistics.sah_cost << ",\n";
+    out << "    \"overlap\": " << statistics.overlap << ",\n";
+    out << "    \"average_child_overlap\": " << statistics.average_child_overlap << ",\n";
+    out << "    \"memory\": {\n";
+    out << "      \"nodes\": " << statistics.node_bytes << ",\n";
+    out << "      \"primitives\": " << statistics.primitive_bytes << ",\n";
+    out << "      \"objects\": " << statistics.object_bytes << ",\n";
+    out << "      \"references\": " << statistics.reference_bytes << ",\n";
+    out << "      \"primitive_blocks\": " << statistics.block_bytes << "\n";
+    out << "    }\n";
+    out << "  }";
+}
+
+void write_json(std::ostream &out, const std::vector<BVHStatistics> &statistics) {
+    out << "[\n";
+    for (size_t i = 0; i < statistics.size(); ++i) {
+        write_entry(out, statistics[i]);
+        out << (i + 1 < statistics.size() ? ",\n" : "\n");
+    }
+    out << "]" << std::endl;
+}
+
+} // namespace raytracing
@@ -0,0 +1,125 @@
+#include "grid.hpp"
+
+#include <numeric>
+
+namespace raytracing {
+
+static constexpr float cell_density = 2.f;
+static constexpr int max_resolution = 1024;
+static constexpr int min_grid_primitives = 1000;
+static constexpr float max_size_variation = 0.5f;
+
+void Grid::build(const std::vector<Geometry> &primitives) {
+    bounds = AABB();
+    cells.clear();
+    references.clear();
+    int n = primitives.size();
+    std::vector<int> identity(n);
+    std::iota(identity.begin(), identity.end(), 0);
+    blocks.build(primitives, identity);
+    if (n == 0) {
+        return;
+    }
+
+    std::vector<AABB> aabbs(n);
+    for (int i = 0; i < n; ++i) {
+        aabbs[i].extend(primitives[i]);
+        bounds.extend(aabbs[i]);
+    }
+    glm::vec3 extent = bounds.max - bounds.min;
+    float max_extent = std::max({extent.x, extent.y, extent.z, std::numeric_limits<float>::min()});
+    extent = glm::max(extent, glm::vec3(max_extent * 1e-3f));
+    bounds.max = bounds.min + extent;
+
+    float scale = std::cbrt(cell_density * n / (extent.x * extent.y * extent.z));
+    for (int axis = 0; axis < 3; ++axis) {
+        resolution[axis] = std::clamp(static_cast<int>(extent[axis] * scale), 1, max_resolution);
+    }
+    cell_size = extent / glm::vec3(resolution);
+
+    auto cell_range = [&](const AABB &aabb, glm::ivec3 &lo, glm::ivec3 &hi) {
+        lo = glm::clamp(glm::ivec3(glm::floor((aabb.min - bounds.min) / cell_size)), glm::ivec3(0), resolution - 1);
+        hi = glm::clamp(glm::ivec3(glm::floor((aabb.max - bounds.min) / cell_size)), glm::ivec3(0), resolution - 1);
+    };
+    auto for_each_cell = [&](int i, auto f) {
+        glm::ivec3 lo, hi;
+        cell_range(aabbs[i], lo, hi);
+        for (int z = lo.z; z <= hi.z; ++z) {
+            for (int y = lo.y; y <= hi.y; ++y) {
+                for (int x = lo.x; x <= hi.x; ++x) {
+                    f((z * resolution.y + y) * resolution.x + x);
+                }
+            }
+        }
+    };
+
+    int n_cells = resolution.x * resolution.y * resolution.z;
+    cells.assign(n_cells + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        for_each_cell(i, [&](int c) { ++cells[c + 1]; });
+    }
+    for (int c = 0; c < n_cells; ++c) {
+        cells[c + 1] += cells[c];
+    }
+
+    references.resize(cells[n_cells]);
+    std::vector<int> cursors(cells.begin(), cells.end() - 1);
+    for (int i = 0; i < n; ++i) {
+        for_each_cell(i, [&](int c) { references[cursors[c]++] = i; });
+    }
+}
+
+size_t Grid::memory_footprint() const {
+    return cells.size() * sizeof(int) + references.size() * sizeof(int) + blocks.memory_footprint();
+}
+
+void Grid::intersect(const std::vector<Object> &primitives, const Ray &r, std::pair<OptInsc, const Object *> &nearest, float &max_distance) const {
+    traverse(r, max_distance, [&](int first, int end) {
+        for (int k = first; k < end; ++k) {
+            auto insc = blocks.intersect(references[k], r);
+            if (insc && insc.value().t < max_distance) {
+                nearest.second = &primitives[references[k]];
+                max_distance = insc.value().t;
+                nearest.first = insc.value();
+            }
+        }
+        return false;
+    });
+}
+
+bool Grid::occluded(const Ray &r, float t_max) const {
+    bool result = false;
+    traverse(r, t_max, [&](int first, int end) {
+        for (int k = first; k < end; ++k) {
+            if (blocks.occluded(references[k], r, t_max)) {
+                result = true;
+                break;
+            }
+        }
+        return result;
+    });
+    return result;
+}
+
+// A grid suits scenes of similarly sized primitives; the spread is measured as the coefficient of variation of the
+// primitive bounding box diagonals.
+bool prefers_grid(const std::vector<Geometry> &primitives) {
+    int n = primitives.size();
+    if (n < min_grid_primitives) {
+        return false;
+    }
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    for (auto &obj : primitives) {
+        AABB aabb;
+        aabb.extend(obj);
+        double size = glm::length(aabb.max - aabb.min);
+        sum += size;
+        sum_sq += size * size;
+    }
+    double mean = sum / n;
+    double variance = std::max(sum_sq / n - mean * mean, 0.0);
+    return std::sqrt(variance) <= max_size_variation * mean;
+}
+
+} // namespace raytracing
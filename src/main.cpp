@@ -1,8 +1,10 @@
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <thread>
 
+#include "bvh_statistics.hpp"
 #include "scene.hpp"
 
 using namespace raytracing;
@@ -14,6 +16,20 @@ int main(int argc, char **argv) {
     auto begin = std::chrono::steady_clock::now();
 
     Scene scene{std::string(argv[1])};
+    if (std::string(argv[2]) == "--bvh-report") {
+        if (scene.accelerator == Accelerator::UniformGrid) {
+            std::cerr << "--bvh-report needs a BVH accelerator, the scene uses the uniform grid" << std::endl;
+            return 1;
+        }
+        auto statistics = collect_statistics(scene);
+        if (argc > 3) {
+            std::ofstream file(argv[3]);
+            write_json(file, statistics);
+        } else {
+            write_json(std::cout, statistics);
+        }
+        return 0;
+    }
     scene.render(std::string(argv[2]), n_threads);
 
     auto end = std::chrono::steady_clock::now();
@@ -0,0 +1,57 @@
+#include "mapped_file.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+namespace raytracing {
+
+#if defined(__unix__) || defined(__APPLE__)
+
+MappedFile::MappedFile(const std::string &fp) {
+    int fd = open(fp.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            begin = static_cast<const char *>(p);
+            length = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (begin != nullptr) {
+        munmap(const_cast<char *>(begin), length);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &fp) {
+    std::ifstream file(fp, std::ios::binary | std::ios::ate);
+    if (file.fail() || file.tellg() <= 0) {
+        return;
+    }
+    buffer.resize(file.tellg());
+    file.seekg(0);
+    if (file.read(buffer.data(), buffer.size())) {
+        begin = buffer.data();
+        length = buffer.size();
+    }
+}
+
+MappedFile::~MappedFile() {}
+
+#endif
+
+} // namespace raytracing
@@ -0,0 +1,188 @@
+#include "mesh.hpp"
+
+#include <stdexcept>
+
+namespace raytracing {
+
+VertexView Mesh::positions() const {
+    if (mapping != nullptr) {
+        return mapped_vertices;
+    }
+    return {reinterpret_cast<const char *>(vertices.data()), sizeof(glm::vec3), vertices.size()};
+}
+
+// Moves the mesh's POSITION and ROTATION into its vertices, so that its triangles are tested in world space. Mapped
+// vertices are read-only and get copied only if they actually move.
+void Mesh::bake_transform() {
+    if (mapping != nullptr) {
+        if (transform.position == glm::vec3(0.f) && transform.rotation == glm::quat(1.f, 0.f, 0.f, 0.f)) {
+            return;
+        }
+        VertexView view = positions();
+        vertices.resize(view.count);
+        for (size_t i = 0; i < view.count; ++i) {
+            vertices[i] = view[i];
+        }
+        mapping = nullptr;
+        mapped_vertices = {nullptr, 0, 0};
+    }
+    for (auto &p : vertices) {
+        p = transform.position + transform.rotation * p;
+    }
+    for (auto &n : normals) {
+        n = transform.rotation * n;
+    }
+    transform.position = glm::vec3(0.f);
+    transform.rotation = transform.inv_rotation = glm::quat(1.f, 0.f, 0.f, 0.f);
+}
+
+// The cache key covers the build settings, the vertex records and the faces.
+uint64_t Mesh::geometry_hash() const {
+    VertexView view = positions();
+    Hasher hasher;
+    bvh.hash_settings(hasher);
+    hasher.add(view.count);
+    hasher.add(view.stride);
+    hasher.add(view.data, view.count * view.stride);
+    hasher.add(triangles.size());
+    hasher.add(triangles.data(), triangles.size() * sizeof(glm::uvec3));
+    return hasher.value;
+}
+
+// Puts the triangles in the leaf order of bvh.references, which must be a permutation of the triangles.
+bool Mesh::reorder_triangles() {
+    if (bvh.references.size() != triangles.size()) {
+        return false;
+    }
+    std::vector<bool> seen(triangles.size(), false);
+    std::vector<glm::uvec3> ordered(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        int index = bvh.references[i];
+        if (seen[index]) {
+            return false;
+        }
+        seen[index] = true;
+        ordered[i] = triangles[index];
+    }
+    triangles.swap(ordered);
+    bvh.references.clear();
+    bvh.references.shrink_to_fit();
+    return true;
+}
+
+void Mesh::build(const BVH &settings) {
+    VertexView view = positions();
+    if (!normals.empty() && normals.size() != view.count) {
+        throw std::runtime_error("mesh needs one normal per vertex");
+    }
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        if (glm::any(glm::greaterThanEqual(triangles[i], glm::uvec3(view.count)))) {
+            throw std::runtime_error("mesh face index out of range: " + std::to_string(i));
+        }
+    }
+
+    // spatial splits clip Objects, so meshes fall back to binning
+    bvh.method = settings.method == BuildMethod::Spatial ? BuildMethod::Binned : settings.method;
+    bvh.treelet_passes = settings.treelet_passes;
+    bvh.cache_directory = settings.cache_directory;
+    bvh.loaded_from_cache = false;
+    uint64_t key = 0;
+    if (!bvh.cache_directory.empty()) {
+        key = geometry_hash();
+        if (bvh.load(bvh.cache_path(key), key, triangles.size()) && reorder_triangles()) {
+            bvh.loaded_from_cache = true;
+            return;
+        }
+    }
+
+    std::vector<PrimitiveRef> refs(triangles.size());
+    for (int i = 0; i < static_cast<int>(triangles.size()); ++i) {
+        auto &triangle = triangles[i];
+        glm::vec3 a = view[triangle.x];
+        glm::vec3 b = view[triangle.y];
+        glm::vec3 c = view[triangle.z];
+        AABB aabb;
+        aabb.extend(a);
+        aabb.extend(b);
+        aabb.extend(c);
+        // leave room for the rounding of the edges the intersection test works with
+        glm::vec3 margin = (glm::abs(aabb.min) + glm::abs(aabb.max)) * 1e-6f;
+        refs[i].aabb.extend(aabb.min - margin);
+        refs[i].aabb.extend(aabb.max + margin);
+        refs[i].center = (a + b + c) / 3.f;
+        refs[i].index = i;
+    }
+
+    bvh.build(refs);
+
+    bvh.references.resize(refs.size());
+    for (size_t i = 0; i < refs.size(); ++i) {
+        bvh.references[i] = refs[i].index;
+    }
+    if (!bvh.cache_directory.empty()) {
+        bvh.save(bvh.cache_path(key), key);
+    }
+    reorder_triangles();
+}
+
+// Mapped vertices live in the page cache and are not counted.
+size_t Mesh::memory_footprint() const {
+    return vertices.size() * sizeof(glm::vec3) + normals.size() * sizeof(glm::vec3) + triangles.size() * sizeof(glm::uvec3) +
+           bvh.nodes.size() * sizeof(Node);
+}
+
+// Like TRIANGLE primitives meshes are two-sided, the normal is turned to face the ray.
+glm::vec3 Mesh::normal(int i, float u, float v, const glm::vec3 &dir) const {
+    VertexView view = positions();
+    auto &triangle = triangles[i];
+    glm::vec3 a = view[triangle.x];
+    glm::vec3 geometric = glm::cross(view[triangle.y] - a, view[triangle.z] - a);
+    glm::vec3 result = geometric;
+    if (!normals.empty()) {
+        result = (1.f - u - v) * normals[triangle.x] + u * normals[triangle.y] + v * normals[triangle.z];
+    }
+    result = glm::normalize(result);
+    return glm::dot(geometric, dir) < 0 ? result : -result;
+}
+
+void Mesh::intersect(const Ray &r, std::pair<OptInsc, const Object *> &nearest, float &max_distance) const {
+    VertexView view = positions();
+    int hit = -1;
+    float hit_u, hit_v;
+    bvh.traverse(r, max_distance, [&](int first, int count) {
+        for (int i = first; i < first + count; ++i) {
+            auto &triangle = triangles[i];
+            glm::vec3 a = view[triangle.x];
+            float u, v;
+            float t = triangle_distance(a, view[triangle.y] - a, view[triangle.z] - a, r, u, v);
+            if (t >= 0 && t < max_distance) {
+                max_distance = t;
+                hit = i;
+                hit_u = u;
+                hit_v = v;
+            }
+        }
+    });
+    if (hit != -1) {
+        nearest.first = Intersection(max_distance, normal(hit, hit_u, hit_v, r.dir), true);
+        nearest.second = &material;
+    }
+}
+
+bool Mesh::occluded(const Ray &r, float t_max) const {
+    VertexView view = positions();
+    return bvh.traverse_any(r, t_max, [&](int first, int count) {
+        for (int i = first; i < first + count; ++i) {
+            auto &triangle = triangles[i];
+            glm::vec3 a = view[triangle.x];
+            float u, v;
+            float t = triangle_distance(a, view[triangle.y] - a, view[triangle.z] - a, r, u, v);
+            if (t >= 0 && t < t_max) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+} // namespace raytracing
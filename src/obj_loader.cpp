@@ -0,0 +1,357 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+namespace raytracing {
+
+// Files above parallel_size are split at line boundaries into chunks of about chunk_size bytes. A first pass counts
+// the vertices, normals and triangles of every chunk, so that the second pass can parse each chunk straight into its
+// slice of the mesh buffers.
+static constexpr size_t parallel_size = size_t(256) << 20;
+static constexpr size_t chunk_size = size_t(16) << 20;
+
+struct ObjChunk {
+    const char *begin;
+    const char *end;
+    size_t vertices = 0;
+    size_t normals = 0;
+    size_t triangles = 0;
+    size_t first_vertex = 0;
+    size_t first_normal = 0;
+    size_t first_triangle = 0;
+    bool missing_normals = false;
+    const char *error = nullptr;
+};
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && is_space(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static bool parse_int(const char *&p, const char *end, int64_t &value) {
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        ++p;
+    }
+    if (p == end || !is_digit(*p)) {
+        return false;
+    }
+    value = 0;
+    for (; p < end && is_digit(*p); ++p) {
+        if (value > (std::numeric_limits<int64_t>::max() - 9) / 10) {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    if (negative) {
+        value = -value;
+    }
+    return true;
+}
+
+// Decimal mantissas of up to 19 significant digits are exact in 64 bits, the scaling by a power of ten is a single
+// rounding in double precision.
+static bool parse_float(const char *&p, const char *end, float &value) {
+    static constexpr double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *s = p;
+    bool negative = s < end && *s == '-';
+    if (s < end && (*s == '-' || *s == '+')) {
+        ++s;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; s < end && is_digit(*s); ++s) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*s - '0');
+            digits += mantissa != 0;
+        } else {
+            ++exponent;
+        }
+    }
+    if (s < end && *s == '.') {
+        for (++s; s < end && is_digit(*s); ++s) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*s - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any) {
+        return false;
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        ++s;
+        int64_t e;
+        if (!parse_int(s, end, e)) {
+            return false;
+        }
+        exponent += std::clamp<int64_t>(e, -1000, 1000);
+    }
+
+    double result = mantissa;
+    if (exponent < 0) {
+        result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+    }
+    value = static_cast<float>(negative ? -result : result);
+    p = s;
+    return true;
+}
+
+static bool parse_vec3(const char *p, const char *end, glm::vec3 &v) {
+    for (int axis = 0; axis < 3; ++axis) {
+        p = skip_spaces(p, end);
+        if (!parse_float(p, end, v[axis]) || (p < end && !is_space(*p))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// OBJ indices start at 1, negative ones count back from the last element defined so far.
+static bool resolve(int64_t index, size_t seen, size_t count, uint32_t &result) {
+    int64_t i = index > 0 ? index - 1 : static_cast<int64_t>(seen) + index;
+    if (index == 0 || i < 0 || i >= static_cast<int64_t>(count)) {
+        return false;
+    }
+    result = i;
+    return true;
+}
+
+enum class ObjLine { Vertex, Normal, Face, Other };
+
+static ObjLine classify(const char *&p, const char *end) {
+    p = skip_spaces(p, end);
+    if (end - p >= 2 && p[0] == 'v' && is_space(p[1])) {
+        p += 2;
+        return ObjLine::Vertex;
+    }
+    if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) {
+        p += 3;
+        return ObjLine::Normal;
+    }
+    if (end - p >= 2 && p[0] == 'f' && is_space(p[1])) {
+        p += 2;
+        return ObjLine::Face;
+    }
+    return ObjLine::Other;
+}
+
+static const char *line_end(const char *p, const char *end) {
+    auto newline = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    return newline != nullptr ? newline : end;
+}
+
+static void count_chunk(ObjChunk &chunk) {
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *end = line_end(p, chunk.end);
+        const char *q = p;
+        switch (classify(q, end)) {
+        case ObjLine::Vertex:
+            ++chunk.vertices;
+            break;
+        case ObjLine::Normal:
+            ++chunk.normals;
+            break;
+        case ObjLine::Face: {
+            int corners = 0;
+            while ((q = skip_spaces(q, end)) < end) {
+                ++corners;
+                while (q < end && !is_space(*q)) {
+                    ++q;
+                }
+            }
+            if (corners < 3) {
+                chunk.error = p;
+                return;
+            }
+            chunk.triangles += corners - 2;
+            break;
+        }
+        case ObjLine::Other:
+            break;
+        }
+        p = end + 1;
+    }
+}
+
+static void parse_chunk(ObjChunk &chunk, Mesh &mesh, std::vector<glm::vec3> &normals, std::vector<glm::uvec3> &corner_normals) {
+    size_t vertex = chunk.first_vertex;
+    size_t normal = chunk.first_normal;
+    size_t triangle = chunk.first_triangle;
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *end = line_end(p, chunk.end);
+        const char *q = p;
+        switch (classify(q, end)) {
+        case ObjLine::Vertex:
+            if (!parse_vec3(q, end, mesh.vertices[vertex++])) {
+                chunk.error = p;
+                return;
+            }
+            break;
+        case ObjLine::Normal:
+            if (!parse_vec3(q, end, normals[normal++])) {
+                chunk.error = p;
+                return;
+            }
+            break;
+        case ObjLine::Face: {
+            // polygons are split into a fan around their first corner
+            int corners = 0;
+            uint32_t first_v = 0, first_n = 0, prev_v = 0, prev_n = 0;
+            while ((q = skip_spaces(q, end)) < end) {
+                int64_t v, t, n = 0;
+                bool valid = parse_int(q, end, v);
+                if (valid && q < end && *q == '/') {
+                    ++q;
+                    if (q < end && *q != '/') {
+                        valid = parse_int(q, end, t);
+                    }
+                    if (valid && q < end && *q == '/') {
+                        ++q;
+                        valid = parse_int(q, end, n);
+                    }
+                }
+                uint32_t vi, ni = 0;
+                valid = valid && (q == end || is_space(*q)) && resolve(v, vertex, mesh.vertices.size(), vi);
+                if (n != 0) {
+                    valid = valid && resolve(n, normal, normals.size(), ni);
+                } else {
+                    chunk.missing_normals = true;
+                }
+                if (!valid) {
+                    chunk.error = p;
+                    return;
+                }
+                if (corners == 0) {
+                    first_v = vi;
+                    first_n = ni;
+                } else if (corners >= 2) {
+                    mesh.triangles[triangle] = {first_v, prev_v, vi};
+                    if (!corner_normals.empty()) {
+                        corner_normals[triangle] = {first_n, prev_n, ni};
+                    }
+                    ++triangle;
+                }
+                prev_v = vi;
+                prev_n = ni;
+                ++corners;
+            }
+            break;
+        }
+        case ObjLine::Other:
+            break;
+        }
+        p = end + 1;
+    }
+}
+
+[[noreturn]] static void throw_parse_error(const MappedFile &file, const char *line) {
+    const char *file_end = file.data() + file.size();
+    size_t number = 1 + std::count(file.data(), line, '\n');
+    throw std::runtime_error("malformed OBJ line " + std::to_string(number) + ": " + std::string(line, line_end(line, file_end)));
+}
+
+// Reads the positions, normals and faces of a Wavefront OBJ file; texture coordinates, groups and materials are
+// skipped. Normals are indexed per face corner in OBJ, a vertex gets the average of the normals its corners use.
+void load_obj(const std::string &fp, Mesh &mesh) {
+    MappedFile file(fp);
+    if (!file.valid()) {
+        std::error_code error;
+        if (std::filesystem::is_regular_file(fp, error) && std::filesystem::file_size(fp, error) == 0) {
+            mesh.vertices.clear();
+            mesh.normals.clear();
+            mesh.triangles.clear();
+            return;
+        }
+        throw std::runtime_error("cannot read OBJ file: " + fp);
+    }
+
+    const char *data = file.data();
+    const char *file_end = data + file.size();
+    size_t n_chunks = file.size() > parallel_size ? std::max<size_t>(1, file.size() / chunk_size) : 1;
+    std::vector<ObjChunk> chunks;
+    const char *begin = data;
+    for (size_t i = 1; i <= n_chunks && begin < file_end; ++i) {
+        const char *end = i == n_chunks ? file_end : std::max(begin, data + file.size() / n_chunks * i);
+        end = std::min(line_end(end, file_end) + 1, file_end);
+        chunks.push_back({begin, end});
+        begin = end;
+    }
+
+    auto for_each_chunk = [&](auto f) {
+        parallel_for(0, chunks.size(), 1, [&](int first, int last) {
+            for (int i = first; i < last; ++i) {
+                f(chunks[i]);
+            }
+        });
+        for (auto &chunk : chunks) {
+            if (chunk.error != nullptr) {
+                throw_parse_error(file, chunk.error);
+            }
+        }
+    };
+
+    for_each_chunk(count_chunk);
+    size_t n_vertices = 0;
+    size_t n_normals = 0;
+    size_t n_triangles = 0;
+    for (auto &chunk : chunks) {
+        chunk.first_vertex = n_vertices;
+        chunk.first_normal = n_normals;
+        chunk.first_triangle = n_triangles;
+        n_vertices += chunk.vertices;
+        n_normals += chunk.normals;
+        n_triangles += chunk.triangles;
+    }
+
+    mesh.vertices.resize(n_vertices);
+    mesh.triangles.resize(n_triangles);
+    std::vector<glm::vec3> normals(n_normals);
+    std::vector<glm::uvec3> corner_normals(n_normals > 0 ? n_triangles : 0);
+    for_each_chunk([&](ObjChunk &chunk) { parse_chunk(chunk, mesh, normals, corner_normals); });
+
+    mesh.normals.clear();
+    bool missing_normals = false;
+    for (auto &chunk : chunks) {
+        missing_normals |= chunk.missing_normals;
+    }
+    if (n_normals == 0 || missing_normals) {
+        return;
+    }
+    mesh.normals.assign(n_vertices, glm::vec3(0.f));
+    for (size_t i = 0; i < n_triangles; ++i) {
+        for (int corner = 0; corner < 3; ++corner) {
+            mesh.normals[mesh.triangles[i][corner]] += normals[corner_normals[i][corner]];
+        }
+    }
+    for (auto &n : mesh.normals) {
+        float length = glm::length(n);
+        if (length > 0.f) {
+            n /= length;
+        }
+    }
+}
+
+} // namespace raytracing
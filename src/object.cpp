@@ -27,18 +27,27 @@ static glm::vec3 keep_max(glm::vec3 v) {
     return u;
 }
 
-Ray Object::translate(const Ray& r) const {
+Ray translate(const Ray& r, const glm::vec3& position, const glm::quat& inv_rotation) {
     return {inv_rotation * (r.pos - position), inv_rotation * r.dir};
 }
 
-glm::vec3 Object::get_center() const {
+Ray Geometry::translate(const Ray& r) const { return raytracing::translate(r, position, inv_rotation); }
+
+// The world space vertex A and the edges from A to B and C, which is how the intersection tests take a triangle.
+void Geometry::get_triangle(glm::vec3& a, glm::vec3& e1, glm::vec3& e2) const {
+    a = position + rotation * tri_A;
+    e1 = position + rotation * tri_B - a;
+    e2 = position + rotation * tri_C - a;
+}
+
+glm::vec3 Geometry::get_center() const {
     switch (shape) {
     case Shape::Box:
         return position;
     case Shape::Ellipsoid:
         return position;
     case Shape::Triangle:
-        return (tri_A + tri_B + tri_C) / 3.f;
+        return position + rotation * ((tri_A + tri_B + tri_C) / 3.f);
     case Shape::Plane:
         throw std::runtime_error("plane has no center");
     default:
@@ -46,81 +55,163 @@ glm::vec3 Object::get_center() const {
     }
 }
 
-OptInsc Object::intersect_plane(const Ray& r) const {
-    float t = -glm::dot(r.pos, plane_normal) / glm::dot(r.dir, plane_normal);
+// Caches the derived placement data; called whenever the shape or placement changes, before any accelerator is built.
+void Geometry::finalize() {
+    if (shape == Shape::Plane) {
+        return;
+    }
+    center = get_center();
+    if (shape == Shape::Triangle) {
+        get_triangle(world_a, world_e1, world_e2);
+    }
+}
+
+OptInsc intersect_plane(const glm::vec3& normal, const Ray& r) {
+    float t = -glm::dot(r.pos, normal) / glm::dot(r.dir, normal);
     if (t >= 0)
-        return Intersection(t, plane_normal);
+        return Intersection(t, normal);
     return std::nullopt;
 }
 
-OptInsc Object::intersect_ellipsoid(const Ray& r) const {
-    float a = glm::dot(r.dir / ellipsoid_radius, r.dir / ellipsoid_radius);
-    float b = 2 * glm::dot(r.pos / ellipsoid_radius, r.dir / ellipsoid_radius);
-    float c = glm::dot(r.pos / ellipsoid_radius, r.pos / ellipsoid_radius) - 1;
+// Distance to the nearest hit in front of the ray origin, or -1. The vector kernels of PrimitiveBlocks repeat these
+// operations in the same order, so that both give the same hits.
+float ellipsoid_distance(const glm::vec3& radius, const Ray& r) {
+    float a = glm::dot(r.dir / radius, r.dir / radius);
+    float b = 2 * glm::dot(r.pos / radius, r.dir / radius);
+    float c = glm::dot(r.pos / radius, r.pos / radius) - 1;
     float d = b * b - 4 * a * c;
     if (d < 0)
-        return std::nullopt;
+        return -1.f;
     d = std::sqrt(d);
     float tm = (-b - d) / (2 * a);
     float tM = (-b + d) / (2 * a);
-    if (tm < 0) {
-        if (tM < 0)
-            return std::nullopt;
-        else
-            return Intersection(tM, glm::normalize(r.at(tM) / (ellipsoid_radius * ellipsoid_radius)));
-    } else
-        return Intersection(tm, glm::normalize(r.at(tm) / (ellipsoid_radius * ellipsoid_radius)));
-}
-
-OptInsc Object::intersect_box(const Ray& r) const {
-    glm::vec3 tm = (-box_size - r.pos) / r.dir;
-    glm::vec3 tM = (box_size - r.pos) / r.dir;
+    if (tm < 0)
+        return tM < 0 ? -1.f : tM;
+    return tm;
+}
+
+float box_distance(const glm::vec3& size, const Ray& r) {
+    glm::vec3 tm = (-size - r.pos) / r.dir;
+    glm::vec3 tM = (size - r.pos) / r.dir;
     float t1 = max3(std::min(tm.x, tM.x), std::min(tm.y, tM.y), std::min(tm.z, tM.z));
     float t2 = min3(std::max(tm.x, tM.x), std::max(tm.y, tM.y), std::max(tm.z, tM.z));
-    if (t1 > t2)
+    if (t1 > t2 || t2 < 0)
+        return -1.f;
+    return t1 < 0 ? t2 : t1;
+}
+
+glm::vec3 ellipsoid_normal(const glm::vec3& radius, const Ray& r, float t) { return glm::normalize(r.at(t) / (radius * radius)); }
+
+glm::vec3 box_normal(const glm::vec3& size, const Ray& r, float t) { return glm::normalize(keep_max(r.at(t) / size)); }
+
+// Triangles are two-sided: the normal faces the ray.
+glm::vec3 triangle_normal(const glm::vec3& e1, const glm::vec3& e2, const glm::vec3& dir) {
+    glm::vec3 normal = glm::normalize(glm::cross(e1, e2));
+    return glm::dot(normal, dir) < 0 ? normal : -normal;
+}
+
+OptInsc intersect_ellipsoid(const glm::vec3& radius, const Ray& r) {
+    float t = ellipsoid_distance(radius, r);
+    if (t < 0)
         return std::nullopt;
-    if (t2 < 0)
+    return Intersection(t, ellipsoid_normal(radius, r, t));
+}
+
+OptInsc intersect_box(const glm::vec3& size, const Ray& r) {
+    float t = box_distance(size, r);
+    if (t < 0)
         return std::nullopt;
-    if (t1 < 0)
-        return Intersection(t2, glm::normalize(keep_max(r.at(t2) / box_size)));
-    return Intersection(t1, glm::normalize(keep_max(r.at(t1) / box_size)));
+    return Intersection(t, box_normal(size, r, t));
 }
 
-OptInsc Object::intersect_triangle(const Ray& r) const {
-    glm::mat3 m(tri_B - tri_A, tri_C - tri_A, -r.dir);
-    m = glm::inverse(m);
-    glm::vec3 v(r.pos - tri_A);
-    v = m * v;
-    if (v.x < 0 || v.y < 0 || v.x + v.y > 1 || v.z < 0) {
+// Moller-Trumbore test of a world space triangle, returns the hit distance or -1. A ray parallel to the triangle
+// divides by a zero determinant, which fails every comparison.
+float triangle_distance(const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, const Ray& r, float& u, float& v) {
+    glm::vec3 pvec = glm::cross(r.dir, e2);
+    float inv_det = 1.f / glm::dot(e1, pvec);
+    glm::vec3 tvec = r.pos - a;
+    u = glm::dot(tvec, pvec) * inv_det;
+    glm::vec3 qvec = glm::cross(tvec, e1);
+    v = glm::dot(r.dir, qvec) * inv_det;
+    float t = glm::dot(e2, qvec) * inv_det;
+    return u >= 0 && v >= 0 && u + v <= 1 && t >= 0 ? t : -1.f;
+}
+
+// Every triangle hit counts as inside.
+OptInsc intersect_triangle(const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, const Ray& r) {
+    float u, v;
+    float t = triangle_distance(a, e1, e2, r, u, v);
+    if (t < 0) {
         return std::nullopt;
     }
-    Intersection res(v.z, glm::normalize(glm::cross(tri_B - tri_A, tri_C - tri_A)));
-    if (glm::dot(res.normal, r.dir) < 0) {
-        res.inside = true;
-        res.normal = -res.normal;
+    return Intersection(t, triangle_normal(e1, e2, r.dir), true);
+}
+
+bool occluded_plane(const glm::vec3& normal, const Ray& r, float t_max) {
+    float t = -glm::dot(r.pos, normal) / glm::dot(r.dir, normal);
+    return t >= 0 && t < t_max;
+}
+
+bool occluded_ellipsoid(const glm::vec3& radius, const Ray& r, float t_max) {
+    float t = ellipsoid_distance(radius, r);
+    return t >= 0 && t < t_max;
+}
+
+bool occluded_box(const glm::vec3& size, const Ray& r, float t_max) {
+    float t = box_distance(size, r);
+    return t >= 0 && t < t_max;
+}
+
+bool occluded_triangle(const glm::vec3& a, const glm::vec3& e1, const glm::vec3& e2, const Ray& r, float t_max) {
+    float u, v;
+    float t = triangle_distance(a, e1, e2, r, u, v);
+    return t >= 0 && t < t_max;
+}
+
+bool Geometry::occluded(const Ray& r, float t_max) const {
+    if (shape == Shape::Triangle) {
+        return occluded_triangle(world_a, world_e1, world_e2, r, t_max);
+    }
+    Ray tr = translate(r);
+    switch (shape) {
+    case Shape::Plane:
+        return occluded_plane(plane_normal, tr, t_max);
+    case Shape::Ellipsoid:
+        return occluded_ellipsoid(ellipsoid_radius, tr, t_max);
+    case Shape::Box:
+        return occluded_box(box_size, tr, t_max);
+    case Shape::Triangle:
+        break;
     }
-    return res;
+    return false;
 }
 
-OptInsc Object::intersect(const Ray& r) const {
+OptInsc Geometry::intersect(const Ray& r) const {
+    if (shape == Shape::Triangle) {
+        return intersect_triangle(world_a, world_e1, world_e2, r);
+    }
     Ray tr = translate(r);
     OptInsc result = std::nullopt;
     switch (shape) {
     case Shape::Plane:
-        result = intersect_plane(tr);
+        result = intersect_plane(plane_normal, tr);
         break;
     case Shape::Ellipsoid:
-        result = intersect_ellipsoid(tr);
+        result = intersect_ellipsoid(ellipsoid_radius, tr);
         break;
     case Shape::Box:
-        result = intersect_box(tr);
+        result = intersect_box(box_size, tr);
         break;
     case Shape::Triangle:
-        result = intersect_triangle(tr);
         break;
     }
+    return to_world(result, tr, rotation);
+}
+
+// Orients the normal against the ray and rotates it back to world space.
+OptInsc to_world(OptInsc result, const Ray& local, const glm::quat& rotation) {
     if (result.has_value()) {
-        result.value().inside = glm::dot(-tr.dir, result.value().normal) < 0;
+        result.value().inside = glm::dot(-local.dir, result.value().normal) < 0;
         if (result.value().inside)
             result.value().normal *= -1;
         result.value().normal = rotation * result.value().normal;
@@ -0,0 +1,423 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "thread_pool.hpp"
+
+namespace raytracing {
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    bool list = false;
+    PlyType count_type;
+    size_t offset = 0;
+};
+
+// stride is the record size of elements without list properties and 0 otherwise.
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    size_t stride = 0;
+
+    int find(const std::string &property) const {
+        for (int i = 0; i < static_cast<int>(properties.size()); ++i) {
+            if (properties[i].name == property) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+static bool parse_type(const std::string &name, PlyType &type) {
+    static const std::pair<const char *, PlyType> names[] = {
+        {"char", PlyType::Int8},     {"int8", PlyType::Int8},       {"uchar", PlyType::UInt8},   {"uint8", PlyType::UInt8},
+        {"short", PlyType::Int16},   {"int16", PlyType::Int16},     {"ushort", PlyType::UInt16}, {"uint16", PlyType::UInt16},
+        {"int", PlyType::Int32},     {"int32", PlyType::Int32},     {"uint", PlyType::UInt32},   {"uint32", PlyType::UInt32},
+        {"float", PlyType::Float32}, {"float32", PlyType::Float32}, {"double", PlyType::Float64}, {"float64", PlyType::Float64}};
+    for (auto &[n, t] : names) {
+        if (name == n) {
+            type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t type_size(PlyType type) {
+    switch (type) {
+    case PlyType::Int8:
+    case PlyType::UInt8:
+        return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16:
+        return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::Float32:
+        return 4;
+    case PlyType::Float64:
+        return 8;
+    }
+    return 0;
+}
+
+template <typename T>
+static T read(const char *p) {
+    T value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static double read_value(const char *p, PlyType type) {
+    switch (type) {
+    case PlyType::Int8:
+        return read<int8_t>(p);
+    case PlyType::UInt8:
+        return read<uint8_t>(p);
+    case PlyType::Int16:
+        return read<int16_t>(p);
+    case PlyType::UInt16:
+        return read<uint16_t>(p);
+    case PlyType::Int32:
+        return read<int32_t>(p);
+    case PlyType::UInt32:
+        return read<uint32_t>(p);
+    case PlyType::Float32:
+        return read<float>(p);
+    case PlyType::Float64:
+        return read<double>(p);
+    }
+    return 0.0;
+}
+
+// Returns the body of the file, past end_header.
+static const char *parse_header(const MappedFile &file, std::vector<PlyElement> &elements) {
+    const char *data = file.data();
+    const char *end = data + file.size();
+    if (file.size() < 4 || std::memcmp(data, "ply", 3) != 0) {
+        throw std::runtime_error("not a PLY file");
+    }
+    const char *header_end = nullptr;
+    bool has_format = false;
+    for (const char *p = data; p < end;) {
+        auto newline = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (newline == nullptr) {
+            break;
+        }
+        std::istringstream iss(std::string(p, newline));
+        std::string keyword;
+        iss >> keyword;
+        p = newline + 1;
+        if (keyword == "end_header") {
+            header_end = p;
+            break;
+        }
+        if (keyword == "format") {
+            std::string format;
+            iss >> format;
+            if (format != "binary_little_endian") {
+                throw std::runtime_error("unsupported PLY format: " + format);
+            }
+            has_format = true;
+        } else if (keyword == "element") {
+            auto &element = elements.emplace_back();
+            if (!(iss >> element.name >> element.count)) {
+                throw std::runtime_error("malformed PLY element: " + iss.str());
+            }
+        } else if (keyword == "property") {
+            if (elements.empty()) {
+                throw std::runtime_error("PLY property outside of an element: " + iss.str());
+            }
+            PlyProperty property;
+            std::string type;
+            iss >> type;
+            property.list = type == "list";
+            if (property.list) {
+                std::string count_type;
+                iss >> count_type >> type;
+                if (!parse_type(count_type, property.count_type)) {
+                    throw std::runtime_error("unknown PLY type: " + count_type);
+                }
+            }
+            if (!parse_type(type, property.type) || !(iss >> property.name)) {
+                throw std::runtime_error("malformed PLY property: " + iss.str());
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+    if (header_end == nullptr || !has_format) {
+        throw std::runtime_error("malformed PLY header");
+    }
+
+    for (auto &element : elements) {
+        for (auto &property : element.properties) {
+            if (property.list) {
+                element.stride = 0;
+                break;
+            }
+            property.offset = element.stride;
+            element.stride += type_size(property.type);
+        }
+    }
+    return header_end;
+}
+
+// Reads an integer property with its declared type; floating point types are not accepted as counts or indices.
+static bool read_integer(const char *p, PlyType type, int64_t &value) {
+    switch (type) {
+    case PlyType::Int8:
+        value = read<int8_t>(p);
+        return true;
+    case PlyType::UInt8:
+        value = read<uint8_t>(p);
+        return true;
+    case PlyType::Int16:
+        value = read<int16_t>(p);
+        return true;
+    case PlyType::UInt16:
+        value = read<uint16_t>(p);
+        return true;
+    case PlyType::Int32:
+        value = read<int32_t>(p);
+        return true;
+    case PlyType::UInt32:
+        value = read<uint32_t>(p);
+        return true;
+    case PlyType::Float32:
+    case PlyType::Float64:
+        break;
+    }
+    return false;
+}
+
+static size_t read_count(const char *p, PlyType type) {
+    int64_t count;
+    if (!read_integer(p, type, count)) {
+        throw std::runtime_error("PLY list counts need an integer type");
+    }
+    return std::max<int64_t>(count, 0);
+}
+
+// Returns the end of the property at p, or nullptr if it runs past end.
+static const char *property_end(const PlyProperty &property, const char *p, const char *end) {
+    size_t size = type_size(property.type);
+    if (property.list) {
+        size_t count_size = type_size(property.count_type);
+        if (static_cast<size_t>(end - p) < count_size) {
+            return nullptr;
+        }
+        size *= read_count(p, property.count_type);
+        p += count_size;
+    }
+    return static_cast<size_t>(end - p) < size ? nullptr : p + size;
+}
+
+// Walks the record at p and returns the position of the next one, or nullptr if it runs past end. list(i, count,
+// items) is called for the list properties.
+template <typename List>
+static const char *next_record(const PlyElement &element, const char *p, const char *end, List list) {
+    for (int i = 0; i < static_cast<int>(element.properties.size()) && p != nullptr; ++i) {
+        auto &property = element.properties[i];
+        const char *next = property_end(property, p, end);
+        if (next != nullptr && property.list) {
+            list(i, read_count(p, property.count_type), p + type_size(property.count_type));
+        }
+        p = next;
+    }
+    return p;
+}
+
+static const char *load_vertices(const PlyElement &element, const char *p, const char *end, std::shared_ptr<const MappedFile> file,
+                                 Mesh &mesh) {
+    int x = element.find("x"), y = element.find("y"), z = element.find("z");
+    int nx = element.find("nx"), ny = element.find("ny"), nz = element.find("nz");
+    if (x == -1 || y == -1 || z == -1) {
+        throw std::runtime_error("PLY vertices need x, y and z");
+    }
+    bool has_normals = nx != -1 && ny != -1 && nz != -1;
+    auto &props = element.properties;
+    auto vec3 = [&](const char *record, int a, int b, int c) {
+        return glm::vec3(read_value(record + props[a].offset, props[a].type), read_value(record + props[b].offset, props[b].type),
+                         read_value(record + props[c].offset, props[c].type));
+    };
+
+    if (element.stride != 0) {
+        if (static_cast<size_t>(end - p) / element.stride < element.count) {
+            throw std::runtime_error("PLY file is truncated");
+        }
+        // packed float positions are used where they are
+        if (props[x].type == PlyType::Float32 && props[y].type == PlyType::Float32 && props[z].type == PlyType::Float32 &&
+            props[y].offset == props[x].offset + 4 && props[z].offset == props[x].offset + 8) {
+            mesh.mapping = file;
+            mesh.mapped_vertices = {p + props[x].offset, element.stride, element.count};
+        } else {
+            mesh.vertices.resize(element.count);
+            for (size_t i = 0; i < element.count; ++i) {
+                mesh.vertices[i] = vec3(p + i * element.stride, x, y, z);
+            }
+        }
+        if (has_normals) {
+            mesh.normals.resize(element.count);
+            for (size_t i = 0; i < element.count; ++i) {
+                mesh.normals[i] = vec3(p + i * element.stride, nx, ny, nz);
+            }
+        }
+        return p + element.count * element.stride;
+    }
+
+    // with list properties the offsets differ per record, they are recomputed for each one
+    mesh.vertices.resize(element.count);
+    if (has_normals) {
+        mesh.normals.resize(element.count);
+    }
+    std::vector<const char *> fields(props.size());
+    for (size_t i = 0; i < element.count; ++i) {
+        const char *q = p;
+        for (size_t j = 0; j < props.size(); ++j) {
+            fields[j] = q;
+            q = property_end(props[j], q, end);
+            if (q == nullptr) {
+                throw std::runtime_error("PLY file is truncated");
+            }
+        }
+        auto field = [&](int k) { return static_cast<float>(read_value(fields[k], props[k].type)); };
+        mesh.vertices[i] = {field(x), field(y), field(z)};
+        if (has_normals) {
+            mesh.normals[i] = {field(nx), field(ny), field(nz)};
+        }
+        p = q;
+    }
+    return p;
+}
+
+static const char *load_faces(const PlyElement &element, const char *p, const char *end, Mesh &mesh) {
+    int indices = element.find("vertex_indices");
+    if (indices == -1) {
+        indices = element.find("vertex_index");
+    }
+    if (indices == -1 || !element.properties[indices].list) {
+        throw std::runtime_error("PLY faces need a vertex_indices list");
+    }
+    mesh.triangles.reserve(element.count);
+    auto &property = element.properties[indices];
+
+    // the layout written by most tools: a byte count followed by 32 bit indices and nothing else per face
+    if (element.properties.size() == 1 && property.count_type == PlyType::UInt8 &&
+        (property.type == PlyType::Int32 || property.type == PlyType::UInt32)) {
+        // pure triangle meshes have fixed size records and are copied in parallel, anything else falls back to the
+        // sequential walk below
+        static constexpr size_t stride = 1 + 3 * sizeof(uint32_t);
+        // the faces are split into batches, so that counts beyond the int range of parallel_for work too
+        static constexpr size_t batch_size = size_t(1) << 20;
+        if (static_cast<size_t>(end - p) / stride >= element.count) {
+            mesh.triangles.resize(element.count);
+            std::atomic_bool triangles_only = true;
+            int n_batches = static_cast<int>((element.count + batch_size - 1) / batch_size);
+            parallel_for(0, n_batches, 1, [&](int first, int last) {
+                size_t last_face = std::min(last * batch_size, element.count);
+                for (size_t i = first * batch_size; i < last_face && triangles_only; ++i) {
+                    const char *face = p + i * stride;
+                    if (*face != 3) {
+                        triangles_only = false;
+                    }
+                    mesh.triangles[i] = {read<uint32_t>(face + 1), read<uint32_t>(face + 5), read<uint32_t>(face + 9)};
+                }
+            });
+            if (triangles_only) {
+                return p + element.count * stride;
+            }
+            mesh.triangles.clear();
+        }
+        for (size_t i = 0; i < element.count; ++i) {
+            if (p == end) {
+                throw std::runtime_error("PLY file is truncated");
+            }
+            size_t count = static_cast<uint8_t>(*p++);
+            if (static_cast<size_t>(end - p) < count * 4) {
+                throw std::runtime_error("PLY file is truncated");
+            }
+            // polygons are split into a fan around their first corner
+            for (size_t k = 2; k < count; ++k) {
+                mesh.triangles.emplace_back(read<uint32_t>(p), read<uint32_t>(p + 4 * (k - 1)), read<uint32_t>(p + 4 * k));
+            }
+            p += count * 4;
+        }
+        return p;
+    }
+
+    for (size_t i = 0; i < element.count; ++i) {
+        p = next_record(element, p, end, [&](int j, size_t count, const char *items) {
+            if (j != indices) {
+                return;
+            }
+            size_t size = type_size(property.type);
+            auto index = [&](size_t k) {
+                int64_t value;
+                if (!read_integer(items + k * size, property.type, value) || value < 0 || value > std::numeric_limits<uint32_t>::max()) {
+                    throw std::runtime_error("invalid PLY vertex index in face " + std::to_string(i));
+                }
+                return static_cast<uint32_t>(value);
+            };
+            for (size_t k = 2; k < count; ++k) {
+                mesh.triangles.emplace_back(index(0), index(k - 1), index(k));
+            }
+        });
+        if (p == nullptr) {
+            throw std::runtime_error("PLY file is truncated");
+        }
+    }
+    return p;
+}
+
+// Reads the vertex and face elements of a binary little-endian PLY file and skips all others. Packed float vertex
+// positions are not copied: the mesh keeps the file mapped and reads them in place.
+void load_ply(const std::string &fp, Mesh &mesh) {
+    auto file = std::make_shared<const MappedFile>(fp);
+    if (!file->valid()) {
+        throw std::runtime_error("cannot read PLY file: " + fp);
+    }
+    std::vector<PlyElement> elements;
+    const char *p = parse_header(*file, elements);
+    const char *end = file->data() + file->size();
+
+    mesh.vertices.clear();
+    mesh.normals.clear();
+    mesh.triangles.clear();
+    mesh.mapping = nullptr;
+    bool has_vertices = false;
+    for (auto &element : elements) {
+        if (element.name == "vertex") {
+            p = load_vertices(element, p, end, file, mesh);
+            has_vertices = true;
+        } else if (element.name == "face") {
+            p = load_faces(element, p, end, mesh);
+        } else if (element.stride != 0) {
+            if (static_cast<size_t>(end - p) / element.stride < element.count) {
+                throw std::runtime_error("PLY file is truncated");
+            }
+            p += element.count * element.stride;
+        } else {
+            for (size_t i = 0; i < element.count && p != nullptr; ++i) {
+                p = next_record(element, p, end, [](int, size_t, const char *) {});
+            }
+            if (p == nullptr) {
+                throw std::runtime_error("PLY file is truncated");
+            }
+        }
+    }
+    if (!has_vertices) {
+        throw std::runtime_error("PLY file has no vertex element: " + fp);
+    }
+}
+
+} // namespace raytracing
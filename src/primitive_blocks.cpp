@@ -0,0 +1,234 @@
+#include "primitive_blocks.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+namespace raytracing {
+
+static_assert(sizeof(PrimitiveBlocks::Record) == 12 * sizeof(float));
+
+void PrimitiveBlocks::build(const std::vector<Geometry> &primitives, const std::vector<int> &references) {
+    records.clear();
+    update(primitives, references, 0);
+}
+
+// Resizes the blocks to the reference count and refreshes the references from first on. The records past the last
+// reference let a block of four lanes be loaded at any position.
+void PrimitiveBlocks::update(const std::vector<Geometry> &primitives, const std::vector<int> &references, int first) {
+    int n = references.size();
+    records.resize(n + block_lanes);
+    std::fill(records.begin() + n, records.end(), Record{{}, Shape::Plane});
+
+    for (int i = first; i < n; ++i) {
+        auto &obj = primitives[references[i]];
+        Record record = {{}, static_cast<uint32_t>(obj.shape) | static_cast<uint32_t>(references[i]) << 2};
+        switch (obj.shape) {
+        case Shape::Box:
+        case Shape::Ellipsoid: {
+            glm::vec3 size = obj.shape == Shape::Box ? obj.box_size : obj.ellipsoid_radius;
+            float data[] = {obj.position.x,     obj.position.y,     obj.position.z, obj.inv_rotation.x, obj.inv_rotation.y,
+                            obj.inv_rotation.z, obj.inv_rotation.w, size.x,         size.y,             size.z};
+            std::copy(std::begin(data), std::end(data), record.fields);
+            break;
+        }
+        case Shape::Triangle: {
+            const glm::vec3 &a = obj.world_a, &e1 = obj.world_e1, &e2 = obj.world_e2;
+            float data[] = {a.x, a.y, a.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z};
+            std::copy(std::begin(data), std::end(data), record.fields);
+            break;
+        }
+        case Shape::Plane:
+            break;
+        }
+        records[i] = record;
+    }
+}
+
+size_t PrimitiveBlocks::memory_footprint() const { return records.size() * sizeof(Record); }
+
+static glm::vec3 vec3_field(const float *fields, int i) { return {fields[i], fields[i + 1], fields[i + 2]}; }
+
+static glm::quat inv_rotation_field(const float *fields) { return glm::quat(fields[6], fields[3], fields[4], fields[5]); }
+
+static float distance(const PrimitiveBlocks::Record &record, const Ray &r) {
+    const float *f = record.fields;
+    switch (record.shape()) {
+    case Shape::Ellipsoid:
+        return ellipsoid_distance(vec3_field(f, 7), translate(r, vec3_field(f, 0), inv_rotation_field(f)));
+    case Shape::Box:
+        return box_distance(vec3_field(f, 7), translate(r, vec3_field(f, 0), inv_rotation_field(f)));
+    case Shape::Triangle: {
+        float u, v;
+        return triangle_distance(vec3_field(f, 0), vec3_field(f, 3), vec3_field(f, 6), r, u, v);
+    }
+    case Shape::Plane:
+        break;
+    }
+    return -1.f;
+}
+
+// The hit of primitive i at distance t, which one of the tests has found.
+Intersection PrimitiveBlocks::intersection(int i, const Ray &r, float t) const {
+    const float *f = records[i].fields;
+    Shape shape = records[i].shape();
+    if (shape == Shape::Triangle) {
+        return Intersection(t, triangle_normal(vec3_field(f, 3), vec3_field(f, 6), r.dir), true);
+    }
+    glm::quat inv_rotation = inv_rotation_field(f);
+    glm::vec3 size = vec3_field(f, 7);
+    Ray tr = translate(r, vec3_field(f, 0), inv_rotation);
+    Intersection local(t, shape == Shape::Box ? box_normal(size, tr, t) : ellipsoid_normal(size, tr, t));
+    return to_world(local, tr, glm::conjugate(inv_rotation)).value();
+}
+
+OptInsc PrimitiveBlocks::intersect(int i, const Ray &r) const {
+    float t = distance(records[i], r);
+    if (t < 0) {
+        return std::nullopt;
+    }
+    return intersection(i, r, t);
+}
+
+bool PrimitiveBlocks::occluded(int i, const Ray &r, float t_max) const {
+    float t = distance(records[i], r);
+    return t >= 0 && t < t_max;
+}
+
+// Number of primitives from first on, before end, that share the shape of the first one, at most one block.
+int PrimitiveBlocks::block_size(int first, int end) const {
+    Shape shape = records[first].shape();
+    int n = 1;
+    while (n < block_lanes && first + n < end && records[first + n].shape() == shape) {
+        ++n;
+    }
+    return n;
+}
+
+#if defined(__SSE__)
+
+struct Vec4x3 {
+    __m128 x, y, z;
+};
+
+static Vec4x3 cross(const Vec4x3 &a, const Vec4x3 &b) {
+    return {_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+            _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+            _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x))};
+}
+
+static __m128 dot(const Vec4x3 &a, const Vec4x3 &b) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+static Vec4x3 rotate(const Vec4x3 &q, __m128 w, const Vec4x3 &v) {
+    Vec4x3 uv = cross(q, v);
+    Vec4x3 uuv = cross(q, uv);
+    __m128 two = _mm_set1_ps(2.f);
+    return {_mm_add_ps(v.x, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(uv.x, w), uuv.x), two)),
+            _mm_add_ps(v.y, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(uv.y, w), uuv.y), two)),
+            _mm_add_ps(v.z, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(uv.z, w), uuv.z), two))};
+}
+
+// Tests a block of count primitives of the same shape and returns the mask of the lanes hit before max_distance, with
+// their distances in t. The comparisons and the operand order of min and max follow the scalar tests, so that every
+// lane gives the same result as distance() would.
+int PrimitiveBlocks::hits(int first, int count, const Ray &r, float max_distance, float *t) const {
+    constexpr int stride = sizeof(Record) / sizeof(float);
+    __m128 f[stride];
+    const float *lanes = reinterpret_cast<const float *>(&records[first]);
+    for (int i = 0; i < stride; i += block_lanes) {
+        for (int k = 0; k < block_lanes; ++k) {
+            f[i + k] = _mm_loadu_ps(lanes + k * stride + i);
+        }
+        _MM_TRANSPOSE4_PS(f[i], f[i + 1], f[i + 2], f[i + 3]);
+    }
+    Vec4x3 pos = {_mm_set1_ps(r.pos.x), _mm_set1_ps(r.pos.y), _mm_set1_ps(r.pos.z)};
+    Vec4x3 dir = {_mm_set1_ps(r.dir.x), _mm_set1_ps(r.dir.y), _mm_set1_ps(r.dir.z)};
+    __m128 zero = _mm_setzero_ps();
+    __m128 sign = _mm_set1_ps(-0.f);
+    __m128 distance;
+    __m128 hit;
+
+    switch (records[first].shape()) {
+    case Shape::Box:
+    case Shape::Ellipsoid: {
+        Vec4x3 q = {f[3], f[4], f[5]};
+        Vec4x3 offset = {_mm_sub_ps(pos.x, f[0]), _mm_sub_ps(pos.y, f[1]), _mm_sub_ps(pos.z, f[2])};
+        Vec4x3 p = rotate(q, f[6], offset);
+        Vec4x3 d = rotate(q, f[6], dir);
+        Vec4x3 size = {f[7], f[8], f[9]};
+
+        if (records[first].shape() == Shape::Box) {
+            __m128 ps[3] = {p.x, p.y, p.z}, ds[3] = {d.x, d.y, d.z}, ss[3] = {size.x, size.y, size.z};
+            __m128 lo[3], hi[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                __m128 tm = _mm_div_ps(_mm_sub_ps(_mm_xor_ps(ss[axis], sign), ps[axis]), ds[axis]);
+                __m128 tM = _mm_div_ps(_mm_sub_ps(ss[axis], ps[axis]), ds[axis]);
+                lo[axis] = _mm_min_ps(tM, tm);
+                hi[axis] = _mm_max_ps(tM, tm);
+            }
+            __m128 t1 = _mm_max_ps(_mm_max_ps(lo[2], lo[1]), lo[0]);
+            __m128 t2 = _mm_min_ps(_mm_min_ps(hi[2], hi[1]), hi[0]);
+            __m128 miss = _mm_or_ps(_mm_cmpgt_ps(t1, t2), _mm_cmplt_ps(t2, zero));
+            __m128 behind = _mm_cmplt_ps(t1, zero);
+            distance = _mm_or_ps(_mm_and_ps(behind, t2), _mm_andnot_ps(behind, t1));
+            hit = _mm_andnot_ps(miss, _mm_cmplt_ps(distance, _mm_set1_ps(max_distance)));
+        } else {
+            Vec4x3 pr = {_mm_div_ps(p.x, size.x), _mm_div_ps(p.y, size.y), _mm_div_ps(p.z, size.z)};
+            Vec4x3 dr = {_mm_div_ps(d.x, size.x), _mm_div_ps(d.y, size.y), _mm_div_ps(d.z, size.z)};
+            __m128 a = dot(dr, dr);
+            __m128 b = _mm_mul_ps(_mm_set1_ps(2.f), dot(pr, dr));
+            __m128 c = _mm_sub_ps(dot(pr, pr), _mm_set1_ps(1.f));
+            __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.f), a), c));
+            __m128 sq = _mm_sqrt_ps(disc);
+            __m128 minus_b = _mm_xor_ps(b, sign);
+            __m128 two_a = _mm_mul_ps(_mm_set1_ps(2.f), a);
+            __m128 tm = _mm_div_ps(_mm_sub_ps(minus_b, sq), two_a);
+            __m128 tM = _mm_div_ps(_mm_add_ps(minus_b, sq), two_a);
+            __m128 behind = _mm_cmplt_ps(tm, zero);
+            __m128 miss = _mm_or_ps(_mm_cmplt_ps(disc, zero), _mm_and_ps(behind, _mm_cmplt_ps(tM, zero)));
+            distance = _mm_or_ps(_mm_and_ps(behind, tM), _mm_andnot_ps(behind, tm));
+            hit = _mm_andnot_ps(miss, _mm_cmplt_ps(distance, _mm_set1_ps(max_distance)));
+        }
+        break;
+    }
+    case Shape::Triangle: {
+        Vec4x3 e1 = {f[3], f[4], f[5]};
+        Vec4x3 e2 = {f[6], f[7], f[8]};
+        Vec4x3 pvec = cross(dir, e2);
+        __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.f), dot(e1, pvec));
+        Vec4x3 tvec = {_mm_sub_ps(pos.x, f[0]), _mm_sub_ps(pos.y, f[1]), _mm_sub_ps(pos.z, f[2])};
+        __m128 u = _mm_mul_ps(dot(tvec, pvec), inv_det);
+        Vec4x3 qvec = cross(tvec, e1);
+        __m128 v = _mm_mul_ps(dot(dir, qvec), inv_det);
+        distance = _mm_mul_ps(dot(e2, qvec), inv_det);
+        hit = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(distance, zero), _mm_cmplt_ps(distance, _mm_set1_ps(max_distance))));
+        break;
+    }
+    case Shape::Plane:
+        return 0;
+    }
+
+    _mm_storeu_ps(t, distance);
+    return _mm_movemask_ps(hit) & ((1 << count) - 1);
+}
+
+#else
+
+int PrimitiveBlocks::hits(int first, int count, const Ray &r, float max_distance, float *t) const {
+    int result = 0;
+    for (int k = 0; k < count; ++k) {
+        t[k] = distance(records[first + k], r);
+        result |= (t[k] >= 0 && t[k] < max_distance) << k;
+    }
+    return result;
+}
+
+#endif
+
+} // namespace raytracing
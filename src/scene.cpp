@@ -1,6 +1,7 @@
 #include "scene.hpp"
 
 #include <atomic>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <limits>
@@ -10,19 +11,41 @@
 
 #include "color.hpp"
 #include "image.hpp"
+#include "packet.hpp"
 #include "sampling.hpp"
 #include "screen_splitter.hpp"
 
 namespace raytracing {
 
-Scene::Scene(std::string fp) : camera(), objects() {
+static void load_mesh(const std::string &fp, Mesh &mesh) {
+    auto begin = std::chrono::steady_clock::now();
+    std::string extension = std::filesystem::path(fp).extension().string();
+    if (extension == ".obj" || extension == ".OBJ") {
+        load_obj(fp, mesh);
+    } else if (extension == ".ply" || extension == ".PLY") {
+        load_ply(fp, mesh);
+    } else {
+        throw std::runtime_error("unsupported mesh file: " + fp);
+    }
+    std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+    std::cerr << "Mesh load in " << delta.count() << "[s], " << mesh.positions().count << (mesh.mapping ? " mapped" : "")
+              << " vertices, " << mesh.triangles.size() << " triangles from " << fp << std::endl;
+}
+
+Scene::Scene(std::string fp) : camera(), geometry(), objects() {
     std::ifstream file(fp);
     if (file.fail()) {
         throw std::runtime_error("input file does not exist");
     }
 
     std::string line;
+    Geometry *primitive = nullptr;
     Object *object = nullptr;
+    Instance *instance = nullptr;
+    Mesh *mesh = nullptr;
+    bool mesh_file = false;
+    std::vector<Geometry> *group_geometry = &geometry;
+    std::vector<Object> *group_objects = &objects;
 
     while (std::getline(file, line)) {
         std::istringstream iss(line);
@@ -35,34 +58,105 @@ Scene::Scene(std::string fp) : camera(), objects() {
         } else if (command == "SAMPLES") {
             iss >> n_samples;
         } else if (command == "NEW_PRIMITIVE") {
-            objects.emplace_back();
-            object = &objects[objects.size() - 1];
+            primitive = &group_geometry->emplace_back();
+            object = &group_objects->emplace_back();
+            instance = nullptr;
+            mesh = nullptr;
         } else if (command == "PLANE") {
-            object->shape = Shape::Plane;
-            iss >> object->plane_normal.x >> object->plane_normal.y >> object->plane_normal.z;
-            object->plane_normal = glm::normalize(object->plane_normal);
-            planes.push_back(*object);
+            if (group_geometry != &geometry) {
+                throw std::runtime_error("planes can't be grouped");
+            }
+            primitive->shape = Shape::Plane;
+            iss >> primitive->plane_normal.x >> primitive->plane_normal.y >> primitive->plane_normal.z;
+            primitive->plane_normal = glm::normalize(primitive->plane_normal);
+            planes.push_back(*primitive);
+            plane_objects.push_back(*object);
+            geometry.pop_back();
             objects.pop_back();
-            object = &planes[planes.size() - 1];
+            primitive = &planes.back();
+            object = &plane_objects.back();
+        } else if (command == "MESH") {
+            // a mesh outside of a group gets a group of its own with a single untransformed instance
+            if (group_geometry == &geometry) {
+                tlas.groups.emplace_back();
+                tlas.instances.emplace_back();
+                tlas.instances.back().group = tlas.groups.size() - 1;
+            }
+            auto &group = tlas.groups.back();
+            group.meshes.emplace_back();
+            mesh = &group.meshes.back();
+            primitive->shape = Shape::Triangle;
+            mesh->transform = *primitive;
+            mesh->material = *object;
+            group_geometry->pop_back();
+            group_objects->pop_back();
+            primitive = &mesh->transform;
+            object = &mesh->material;
+            std::string name;
+            mesh_file = static_cast<bool>(iss >> name);
+            if (mesh_file) {
+                load_mesh((std::filesystem::path(fp).parent_path() / name).string(), *mesh);
+            }
+        } else if (command == "VERTEX" || command == "NORMAL" || command == "FACE") {
+            if (mesh == nullptr) {
+                throw std::runtime_error(command + " outside of a mesh");
+            }
+            if (mesh_file) {
+                throw std::runtime_error(command + " in a mesh loaded from a file");
+            }
+            if (command == "FACE") {
+                glm::uvec3 &triangle = mesh->triangles.emplace_back();
+                iss >> triangle.x >> triangle.y >> triangle.z;
+            } else {
+                glm::vec3 &p = (command == "VERTEX" ? mesh->vertices : mesh->normals).emplace_back();
+                iss >> p.x >> p.y >> p.z;
+            }
+        } else if (command == "GROUP") {
+            tlas.groups.emplace_back();
+            iss >> tlas.groups.back().name;
+            group_geometry = &tlas.groups.back().geometry;
+            group_objects = &tlas.groups.back().objects;
+            primitive = nullptr;
+            object = nullptr;
+            mesh = nullptr;
+        } else if (command == "END_GROUP") {
+            group_geometry = &geometry;
+            group_objects = &objects;
+            primitive = nullptr;
+            object = nullptr;
+            mesh = nullptr;
+        } else if (command == "INSTANCE") {
+            std::string name;
+            iss >> name;
+            tlas.instances.emplace_back();
+            instance = &tlas.instances.back();
+            mesh = nullptr;
+            instance->group = tlas.find_group(name);
+            if (instance->group == -1) {
+                throw std::runtime_error("unknown group: " + name);
+            }
         } else if (command == "ELLIPSOID") {
-            object->shape = Shape::Ellipsoid;
-            iss >> object->ellipsoid_radius.x >> object->ellipsoid_radius.y >> object->ellipsoid_radius.z;
+            primitive->shape = Shape::Ellipsoid;
+            iss >> primitive->ellipsoid_radius.x >> primitive->ellipsoid_radius.y >> primitive->ellipsoid_radius.z;
         } else if (command == "BOX") {
-            object->shape = Shape::Box;
-            iss >> object->box_size.x >> object->box_size.y >> object->box_size.z;
+            primitive->shape = Shape::Box;
+            iss >> primitive->box_size.x >> primitive->box_size.y >> primitive->box_size.z;
         } else if (command == "TRIANGLE") {
-            object->shape = Shape::Triangle;
-            iss >> object->tri_A.x >> object->tri_A.y >> object->tri_A.z;
-            iss >> object->tri_B.x >> object->tri_B.y >> object->tri_B.z;
-            iss >> object->tri_C.x >> object->tri_C.y >> object->tri_C.z;
+            primitive->shape = Shape::Triangle;
+            iss >> primitive->tri_A.x >> primitive->tri_A.y >> primitive->tri_A.z;
+            iss >> primitive->tri_B.x >> primitive->tri_B.y >> primitive->tri_B.z;
+            iss >> primitive->tri_C.x >> primitive->tri_C.y >> primitive->tri_C.z;
         } else if (command == "COLOR") {
             iss >> object->color.x >> object->color.y >> object->color.z;
         } else if (command == "POSITION") {
-            iss >> object->position.x >> object->position.y >> object->position.z;
+            glm::vec3 &position = instance != nullptr ? instance->position : primitive->position;
+            iss >> position.x >> position.y >> position.z;
         } else if (command == "ROTATION") {
-            iss >> object->rotation.x >> object->rotation.y >> object->rotation.z >> object->rotation.w;
-            object->rotation = glm::normalize(object->rotation);
-            object->inv_rotation = glm::inverse(object->rotation);
+            glm::quat &rotation = instance != nullptr ? instance->rotation : primitive->rotation;
+            iss >> rotation.x >> rotation.y >> rotation.z >> rotation.w;
+            rotation = glm::normalize(rotation);
+            // the conjugate of a unit quaternion is its inverse, and conjugating it again gives back rotation exactly
+            (instance != nullptr ? instance->inv_rotation : primitive->inv_rotation) = glm::conjugate(rotation);
         } else if (command == "CAMERA_POSITION") {
             iss >> camera.position.x >> camera.position.y >> camera.position.z;
         } else if (command == "CAMERA_RIGHT") {
@@ -84,32 +178,205 @@ Scene::Scene(std::string fp) : camera(), objects() {
             object->material = Material::Dielectric;
         } else if (command == "METALLIC") {
             object->material = Material::Metallic;
+        } else if (command == "BVH_BUILDER") {
+            std::string method;
+            iss >> method;
+            if (method == "SWEEP") {
+                bvh.method = BuildMethod::Sweep;
+            } else if (method == "BINNED") {
+                bvh.method = BuildMethod::Binned;
+            } else if (method == "LINEAR") {
+                bvh.method = BuildMethod::Linear;
+            } else if (method == "SPATIAL") {
+                bvh.method = BuildMethod::Spatial;
+            } else {
+                std::cerr << "WARNING: Unknown BVH builder: " << method << std::endl;
+            }
+        } else if (command == "BVH_TREELET_PASSES") {
+            iss >> bvh.treelet_passes;
+        } else if (command == "BVH_DUPLICATION_BUDGET") {
+            iss >> bvh.duplication_budget;
+        } else if (command == "BVH_REBUILD_THRESHOLD") {
+            iss >> bvh.rebuild_threshold;
+        } else if (command == "PACKET_SIZE") {
+            iss >> packet_size;
+            if (packet_size != 1 && packet_size != 4 && packet_size != 8 && packet_size != 16) {
+                std::cerr << "WARNING: Unsupported packet size: " << packet_size << std::endl;
+                packet_size = 1;
+            }
+        } else if (command == "BVH_CACHE") {
+            iss >> bvh.cache_directory;
+        } else if (command == "ACCELERATOR") {
+            std::string type;
+            iss >> type;
+            if (type == "BVH2") {
+                accelerator = Accelerator::Binary;
+            } else if (type == "BVH4") {
+                accelerator = Accelerator::Wide4;
+            } else if (type == "BVH8") {
+                accelerator = Accelerator::Wide8;
+            } else if (type == "GRID") {
+                accelerator = Accelerator::UniformGrid;
+            } else if (type == "AUTO") {
+                auto_accelerator = true;
+            } else {
+                std::cerr << "WARNING: Unknown accelerator: " << type << std::endl;
+            }
         } else if (command != "") {
-            std::cout << "WARNING: Unknown command: " << command << std::endl;
+            std::cerr << "WARNING: Unknown command: " << command << std::endl;
             continue;
         }
     }
 
-    for (auto& obj : objects) {
-        obj.center = obj.get_center();
+    for (auto& obj : geometry) {
+        obj.finalize();
+    }
+    for (auto &group : tlas.groups) {
+        for (auto &mesh : group.meshes) {
+            mesh.bake_transform();
+        }
+    }
+
+    if (auto_accelerator) {
+        accelerator = prefers_grid(geometry) ? Accelerator::UniformGrid : Accelerator::Binary;
+        std::cerr << "Selected accelerator " << (accelerator == Accelerator::UniformGrid ? "GRID" : "BVH2") << std::endl;
+    }
+
+    if (accelerator == Accelerator::UniformGrid) {
+        build_grid();
+    } else {
+        auto begin = std::chrono::steady_clock::now();
+
+        bvh.build(geometry);
+
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<float> delta = end - begin;
+        std::cerr << (bvh.loaded_from_cache ? "BVH loaded from cache in " : "BVH build in ") << delta.count() << "[s], SAH cost "
+                  << bvh.sah_cost() << std::endl;
+        if (bvh.references.size() != geometry.size()) {
+            std::cerr << "Spatial splits added " << bvh.references.size() - geometry.size() << " primitive references" << std::endl;
+        }
+    }
+
+    if (!tlas.instances.empty()) {
+        auto begin = std::chrono::steady_clock::now();
+        tlas.build(bvh);
+        std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+        size_t n_primitives = 0;
+        size_t n_triangles = 0;
+        size_t mesh_bytes = 0;
+        int n_cached = 0;
+        for (auto &group : tlas.groups) {
+            n_primitives += group.geometry.size();
+            n_cached += group.bvh.loaded_from_cache;
+            for (auto &mesh : group.meshes) {
+                n_triangles += mesh.triangles.size();
+                mesh_bytes += mesh.memory_footprint();
+                n_cached += mesh.bvh.loaded_from_cache;
+            }
+        }
+        std::cerr << "TLAS build in " << delta.count() << "[s], " << tlas.instances.size() << " instances of " << n_primitives
+                  << " grouped primitives";
+        if (n_triangles > 0) {
+            std::cerr << " and " << n_triangles << " mesh triangles in " << mesh_bytes << " bytes";
+        }
+        if (n_cached > 0) {
+            std::cerr << ", " << n_cached << " BVHs loaded from cache";
+        }
+        std::cerr << std::endl;
     }
 
+    build_wide();
+}
+
+void Scene::build_grid() {
     auto begin = std::chrono::steady_clock::now();
-    
-    bvh.build(objects);
+    grid.build(geometry);
+    std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+    std::cerr << "Grid build in " << delta.count() << "[s], " << grid.resolution.x << "x" << grid.resolution.y << "x" << grid.resolution.z
+              << " cells, " << grid.references.size() << " references, " << grid.memory_footprint() << " bytes" << std::endl;
+}
+
+void Scene::build_wide() {
+    if (accelerator == Accelerator::Wide4) {
+        auto begin = std::chrono::steady_clock::now();
+        bvh4.build(bvh);
+        std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+        std::cerr << "BVH4 collapse in " << delta.count() << "[s], " << bvh4.nodes.size() << " nodes" << std::endl;
+    }
+    if (accelerator == Accelerator::Wide8) {
+        auto begin = std::chrono::steady_clock::now();
+        bvh8.build(bvh);
+        std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+        std::cerr << "BVH8 collapse in " << delta.count() << "[s], " << bvh8.nodes.size() << " nodes, " << bvh8.memory_footprint()
+                  << " bytes (BVH2: " << bvh.nodes.size() * sizeof(Node) << " bytes)" << (bvh8.use_avx2 ? ", AVX2" : "") << std::endl;
+    }
+}
+
+void Scene::update() {
+    for (auto& obj : geometry) {
+        obj.finalize();
+    }
+
+    if (accelerator == Accelerator::UniformGrid) {
+        build_grid();
+        return;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    bool rebuilt = bvh.update(geometry);
+    std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+    std::cerr << "BVH " << (rebuilt ? "rebuild" : "refit") << " in " << delta.count() << "[s], SAH cost " << bvh.sah_cost() << std::endl;
+
+    build_wide();
+}
+
+// Adds primitives to the scene without rebuilding the BVH; the returned ids can be passed to remove().
+std::vector<int> Scene::insert(std::vector<Geometry> added, const std::vector<Object>& added_objects) {
+    if (accelerator == Accelerator::UniformGrid) {
+        throw std::runtime_error("incremental edits need a BVH accelerator");
+    }
+    if (added.size() != added_objects.size()) {
+        throw std::runtime_error("inserted primitives need one object each");
+    }
+    for (auto& obj : added) {
+        if (obj.shape == Shape::Plane) {
+            throw std::runtime_error("planes can't be inserted");
+        }
+        obj.finalize();
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<int> ids = bvh.insert(geometry, added);
+    objects.insert(objects.end(), added_objects.begin(), added_objects.end());
+    std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+    std::cerr << "BVH insert of " << added.size() << " primitives in " << delta.count() << "[s], SAH cost " << bvh.sah_cost() << std::endl;
+
+    build_wide();
+    return ids;
+}
+
+void Scene::remove(const std::vector<int>& ids) {
+    if (accelerator == Accelerator::UniformGrid) {
+        throw std::runtime_error("incremental edits need a BVH accelerator");
+    }
+    auto begin = std::chrono::steady_clock::now();
+    bvh.remove(geometry, objects, ids);
+    std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+    std::cerr << "BVH remove of " << ids.size() << " primitives in " << delta.count() << "[s], SAH cost " << bvh.sah_cost() << std::endl;
 
-    auto end = std::chrono::steady_clock::now();
-    std::chrono::duration<float> delta = end - begin;
-    std::cerr << "BVH build in " << delta.count() << "[s]" << std::endl;
+    build_wide();
 }
 
+static constexpr int tile_size = 8;
+
 static void show_progress(float percentage) { std::cerr << "\r" << std::round(percentage * 100) << "%" << std::flush; }
 
 void Scene::render(std::string fp, int n_threads) const {
     int total_pixels = camera.width * camera.height;
     std::vector<Pixel> image_data(total_pixels);
     std::atomic_int pixels_done = 0;
-    ScreenSplitter<8> splitter(camera.width, camera.height);
+    ScreenSplitter<tile_size> splitter(camera.width, camera.height);
 
     auto job = [&](int i) {
         RandomContext ctx(i);
@@ -119,6 +386,32 @@ void Scene::render(std::string fp, int n_threads) const {
             if (x == -1) {
                 break;
             }
+            // PACKET_SIZE above 1 traces the camera rays of a tile in packets through the binary BVH; the wide trees and the
+            // grid trace them one by one. Packets draw all camera samples of a tile before shading, so their images differ
+            // in noise from the default one ray at a time.
+            if (packet_size > 1 && accelerator == Accelerator::Binary) {
+                int n_rows = h - y;
+                int n_pixels = (w - x) * n_rows;
+                Ray rays[tile_size * tile_size];
+                std::pair<OptInsc, const Object *> hits[tile_size * tile_size];
+                glm::vec3 colors[tile_size * tile_size] = {};
+                for (int s = 0; s < n_samples; ++s) {
+                    for (int p = 0; p < n_pixels; ++p) {
+                        rays[p] = camera.get_ray(x + p / n_rows + d(ctx.rng), y + p % n_rows + d(ctx.rng));
+                    }
+                    for (int p = 0; p < n_pixels; p += packet_size) {
+                        intersect_packet(rays + p, std::min(packet_size, n_pixels - p), hits + p);
+                    }
+                    for (int p = 0; p < n_pixels; ++p) {
+                        colors[p] += ray_depth == 0 ? glm::vec3(0.f) : shade(rays[p], hits[p], ray_depth, ctx);
+                    }
+                }
+                for (int p = 0; p < n_pixels; ++p) {
+                    image_data[x + p / n_rows + (y + p % n_rows) * camera.width] = aces_tonemap(colors[p] / static_cast<float>(n_samples));
+                }
+                pixels_done += n_pixels;
+                continue;
+            }
             for (int i = x; i < w; ++i) {
                 for (int j = y; j < h; ++j) {
                     glm::vec3 result_color(0.f);
@@ -152,7 +445,7 @@ void Scene::render(std::string fp, int n_threads) const {
     }
 
     show_progress(1.f);
-    std::cout << std::endl;
+    std::cerr << std::endl;
 
     save_ppm(reinterpret_cast<const char *>(image_data.data()), camera.width, camera.height, fp.c_str());
 }
@@ -160,25 +453,103 @@ void Scene::render(std::string fp, int n_threads) const {
 std::pair<OptInsc, const Object *> Scene::intersect(const Ray& ray, float max_distance) const {
     std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
 
-    for (auto& obj : planes) {
-        auto insc = obj.intersect(ray);
+    for (size_t i = 0; i < planes.size(); ++i) {
+        auto insc = planes[i].intersect(ray);
         if (insc && insc.value().t < max_distance) {
-            nearest.second = &obj;
+            nearest.second = &plane_objects[i];
             max_distance = insc.value().t;
             nearest.first = insc.value();
         }
     }
 
-    bvh.intersect(objects, ray, nearest, max_distance);
+    switch (accelerator) {
+    case Accelerator::Binary:
+        bvh.intersect(objects, ray, nearest, max_distance);
+        break;
+    case Accelerator::Wide4:
+        bvh4.intersect(objects, ray, nearest, max_distance);
+        break;
+    case Accelerator::Wide8:
+        bvh8.intersect(objects, ray, nearest, max_distance);
+        break;
+    case Accelerator::UniformGrid:
+        grid.intersect(objects, ray, nearest, max_distance);
+        break;
+    }
+    if (!tlas.instances.empty()) {
+        tlas.intersect(ray, nearest, max_distance);
+    }
     
     return nearest;
 }
 
+void Scene::intersect_packet(const Ray *rays, int n, std::pair<OptInsc, const Object *> *hits) const {
+    float distances[16];
+    for (int k = 0; k < n; ++k) {
+        hits[k] = {std::nullopt, nullptr};
+        distances[k] = std::numeric_limits<float>::infinity();
+        for (size_t i = 0; i < planes.size(); ++i) {
+            auto insc = planes[i].intersect(rays[k]);
+            if (insc && insc.value().t < distances[k]) {
+                hits[k].second = &plane_objects[i];
+                distances[k] = insc.value().t;
+                hits[k].first = insc.value();
+            }
+        }
+    }
+
+    switch (packet_size) {
+    case 4:
+        raytracing::intersect_packet<4>(bvh, objects, rays, n, hits, distances);
+        break;
+    case 8:
+        raytracing::intersect_packet<8>(bvh, objects, rays, n, hits, distances);
+        break;
+    case 16:
+        raytracing::intersect_packet<16>(bvh, objects, rays, n, hits, distances);
+        break;
+    }
+
+    if (!tlas.instances.empty()) {
+        for (int k = 0; k < n; ++k) {
+            tlas.intersect(rays[k], hits[k], distances[k]);
+        }
+    }
+}
+
+bool Scene::occluded(const Ray& ray, float t_max) const {
+    for (auto& obj : planes) {
+        if (obj.occluded(ray, t_max)) {
+            return true;
+        }
+    }
+
+    if (!tlas.instances.empty() && tlas.occluded(ray, t_max)) {
+        return true;
+    }
+
+    switch (accelerator) {
+    case Accelerator::Binary:
+        return bvh.occluded(ray, t_max);
+    case Accelerator::Wide4:
+        return bvh4.occluded(ray, t_max);
+    case Accelerator::Wide8:
+        return bvh8.occluded(ray, t_max);
+    case Accelerator::UniformGrid:
+        return grid.occluded(ray, t_max);
+    }
+    return false;
+}
+
 glm::vec3 Scene::get_color(const Ray& ray, int depth, RandomContext& ctx) const {
     if (depth == 0)
         return {0.f, 0.f, 0.f};
 
-    auto [insc, p_obj] = intersect(ray);
+    return shade(ray, intersect(ray), depth, ctx);
+}
+
+glm::vec3 Scene::shade(const Ray& ray, const std::pair<OptInsc, const Object*>& hit, int depth, RandomContext& ctx) const {
+    auto [insc, p_obj] = hit;
     if (p_obj == nullptr)
         return bg_color;
 
@@ -0,0 +1,123 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace raytracing {
+
+ThreadPool::ThreadPool(int n_threads) {
+    workers.reserve(n_threads);
+    for (int i = 0; i < n_threads; ++i) {
+        workers.emplace_back([this]() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    cv.wait(guard, [this]() { return stopping || !tasks.empty(); });
+                    if (tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+bool ThreadPool::run_pending() {
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (tasks.empty()) {
+            return false;
+        }
+        task = std::move(tasks.back());
+        tasks.pop_back();
+    }
+    task();
+    return true;
+}
+
+int ThreadPool::size() const { return workers.size() + 1; }
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+TaskGroup::TaskGroup(ThreadPool &pool) : pool(pool) {}
+
+TaskGroup::~TaskGroup() { drain(); }
+
+void TaskGroup::run(std::function<void()> task) {
+    ++pending;
+    pool.push([this, task = std::move(task)]() {
+        struct Done {
+            std::atomic_int &pending;
+            ~Done() { --pending; }
+        } done{pending};
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(error_lock);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    });
+}
+
+void TaskGroup::drain() {
+    while (pending != 0) {
+        if (!pool.run_pending()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void TaskGroup::wait() {
+    drain();
+    std::exception_ptr result;
+    {
+        std::lock_guard<std::mutex> guard(error_lock);
+        std::swap(result, error);
+    }
+    if (result) {
+        std::rethrow_exception(result);
+    }
+}
+
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)> &f) {
+    if (end - begin <= grain) {
+        f(begin, end);
+        return;
+    }
+    TaskGroup group;
+    for (int i = begin; i < end; i += grain) {
+        int chunk_end = std::min(end, i + grain);
+        group.run([&f, i, chunk_end]() { f(i, chunk_end); });
+    }
+    group.wait();
+}
+
+} // namespace raytracing
@@ -0,0 +1,105 @@
+#include "tlas.hpp"
+
+namespace raytracing {
+
+Ray Instance::translate(const Ray &r) const { return {inv_rotation * (r.pos - position), inv_rotation * r.dir}; }
+
+int TLAS::find_group(const std::string &name) const {
+    for (int i = 0; i < static_cast<int>(groups.size()); ++i) {
+        if (groups[i].name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void TLAS::build(const BVH &settings) {
+    for (auto &group : groups) {
+        for (auto &geometry : group.geometry) {
+            geometry.finalize();
+        }
+        group.bvh.method = settings.method;
+        group.bvh.treelet_passes = settings.treelet_passes;
+        group.bvh.duplication_budget = settings.duplication_budget;
+        group.bvh.cache_directory = settings.cache_directory;
+        group.bvh.build(group.geometry);
+        for (auto &mesh : group.meshes) {
+            mesh.build(settings);
+        }
+    }
+
+    std::vector<PrimitiveRef> refs;
+    refs.reserve(instances.size());
+    for (int i = 0; i < static_cast<int>(instances.size()); ++i) {
+        auto &instance = instances[i];
+        auto &group = groups[instance.group];
+        AABB local;
+        if (group.bvh.root != -1) {
+            local.extend(group.bvh.nodes[group.bvh.root].aabb);
+        }
+        for (auto &mesh : group.meshes) {
+            if (mesh.bvh.root != -1) {
+                local.extend(mesh.bvh.nodes[mesh.bvh.root].aabb);
+            }
+        }
+        if (local.min.x > local.max.x) {
+            continue;
+        }
+        PrimitiveRef ref;
+        for (int corner = 0; corner < 8; ++corner) {
+            glm::vec3 p(corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y, corner & 4 ? local.max.z : local.min.z);
+            ref.aabb.extend(instance.position + instance.rotation * p);
+        }
+        ref.center = (ref.aabb.min + ref.aabb.max) * 0.5f;
+        ref.index = i;
+        refs.push_back(ref);
+    }
+
+    bvh.build(refs);
+
+    std::vector<Instance> ordered;
+    ordered.reserve(refs.size());
+    for (auto &ref : refs) {
+        ordered.push_back(instances[ref.index]);
+    }
+    instances.swap(ordered);
+}
+
+void TLAS::intersect(const Ray &r, std::pair<OptInsc, const Object *> &nearest, float &max_distance) const {
+    bvh.traverse(r, max_distance, [&](int first, int count) {
+        for (int i = first; i < first + count; ++i) {
+            auto &instance = instances[i];
+            auto &group = groups[instance.group];
+            float distance = max_distance;
+            Ray local = instance.translate(r);
+            group.bvh.intersect(group.objects, local, nearest, max_distance);
+            for (auto &mesh : group.meshes) {
+                mesh.intersect(local, nearest, max_distance);
+            }
+            if (max_distance < distance) {
+                nearest.first.value().normal = instance.rotation * nearest.first.value().normal;
+            }
+        }
+    });
+}
+
+bool TLAS::occluded(const Ray &r, float t_max) const {
+    return bvh.traverse_any(r, t_max, [&](int first, int count) {
+        for (int i = first; i < first + count; ++i) {
+            auto &instance = instances[i];
+            auto &group = groups[instance.group];
+            Ray local = instance.translate(r);
+            if (group.bvh.occluded(local, t_max)) {
+                return true;
+            }
+            for (auto &mesh : group.meshes) {
+                if (mesh.occluded(local, t_max)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    });
+}
+
+} // namespace raytracing
@@ -0,0 +1,125 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "test.hpp"
+
+using namespace raytracing;
+using namespace raytracing::test;
+
+static BVH cached_bvh(const std::vector<Geometry> &primitives, const std::string &directory, BuildMethod method = BuildMethod::Binned) {
+    BVH bvh;
+    bvh.method = method;
+    bvh.cache_directory = directory;
+    bvh.build(primitives);
+    return bvh;
+}
+
+static void check_same_tree(const BVH &expected, const BVH &actual) {
+    CHECK(actual.root == expected.root);
+    CHECK(actual.nodes.size() == expected.nodes.size());
+    CHECK(std::memcmp(actual.nodes.data(), expected.nodes.data(), expected.nodes.size() * sizeof(Node)) == 0);
+    CHECK(actual.references == expected.references);
+}
+
+static int cache_files(const std::string &directory) {
+    auto files = std::filesystem::directory_iterator(directory);
+    return std::distance(begin(files), end(files));
+}
+
+TEST(cache_round_trip) {
+    TempDirectory directory;
+    std::mt19937 rng(23);
+    auto primitives = random_primitives(rng, 2000);
+    for (auto method : {BuildMethod::Binned, BuildMethod::Spatial}) {
+        BVH built = cached_bvh(primitives, directory.path, method);
+        CHECK(!built.loaded_from_cache);
+        CHECK(std::filesystem::exists(built.cache_path(built.geometry_hash(primitives))));
+
+        BVH loaded = cached_bvh(primitives, directory.path, method);
+        CHECK(loaded.loaded_from_cache);
+        check_same_tree(built, loaded);
+        CHECK(loaded.built_sah_cost == built.built_sah_cost);
+        check_tree(loaded, primitives, method != BuildMethod::Spatial);
+
+        std::vector<Object> objects(primitives.size());
+        for (int i = 0; i < 1000; ++i) {
+            Ray r = random_ray(rng);
+            std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+            float max_distance = std::numeric_limits<float>::infinity();
+            loaded.intersect(objects, r, nearest, max_distance);
+            check_same_hit(brute_force(primitives, r), to_hit(objects, nearest, max_distance));
+        }
+    }
+    CHECK(cache_files(directory.path) == 2);
+}
+
+TEST(cache_empty_scene_round_trip) {
+    TempDirectory directory;
+    std::vector<Geometry> primitives;
+    BVH built = cached_bvh(primitives, directory.path);
+    BVH loaded = cached_bvh(primitives, directory.path);
+    CHECK(loaded.loaded_from_cache);
+    CHECK(loaded.root == -1);
+}
+
+// Any change to a primitive or to the build settings gives a new key, so a stale tree is never loaded.
+TEST(cache_invalidation) {
+    TempDirectory directory;
+    std::mt19937 rng(29);
+    auto primitives = random_primitives(rng, 500);
+    cached_bvh(primitives, directory.path);
+    CHECK(cached_bvh(primitives, directory.path).loaded_from_cache);
+
+    auto moved = primitives;
+    moved[123].position.x += 1e-3f;
+    moved[123].finalize();
+    CHECK(!cached_bvh(moved, directory.path).loaded_from_cache);
+
+    auto reshaped = primitives;
+    CHECK(reshaped[302].shape == Shape::Triangle);
+    reshaped[302].tri_B.y += 1e-3f;
+    reshaped[302].finalize();
+    CHECK(!cached_bvh(reshaped, directory.path).loaded_from_cache);
+
+    auto fewer = primitives;
+    fewer.pop_back();
+    CHECK(!cached_bvh(fewer, directory.path).loaded_from_cache);
+
+    CHECK(!cached_bvh(primitives, directory.path, BuildMethod::Sweep).loaded_from_cache);
+    BVH settings;
+    settings.treelet_passes = 2;
+    settings.cache_directory = directory.path;
+    settings.build(primitives);
+    CHECK(!settings.loaded_from_cache);
+    CHECK(cache_files(directory.path) == 6);
+}
+
+// A damaged cache file is rebuilt and overwritten rather than loaded.
+TEST(cache_rejects_damaged_files) {
+    TempDirectory directory;
+    std::mt19937 rng(31);
+    auto primitives = random_primitives(rng, 500);
+    BVH built = cached_bvh(primitives, directory.path);
+    std::string path = built.cache_path(built.geometry_hash(primitives));
+    auto size = std::filesystem::file_size(path);
+
+    std::filesystem::resize_file(path, size - 4);
+    BVH truncated = cached_bvh(primitives, directory.path);
+    CHECK(!truncated.loaded_from_cache);
+    check_same_tree(built, truncated);
+    CHECK(std::filesystem::file_size(path) == size);
+
+    {
+        // the root's right child past the end of the nodes, the root follows the 40 byte header
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(40 + sizeof(AABB));
+        int offset = built.nodes.size() + 5;
+        file.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+    }
+    BVH corrupted = cached_bvh(primitives, directory.path);
+    CHECK(!corrupted.loaded_from_cache);
+    check_same_tree(built, corrupted);
+
+    CHECK(cached_bvh(primitives, directory.path).loaded_from_cache);
+}
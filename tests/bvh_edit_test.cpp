@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#include "packet.hpp"
+#include "test.hpp"
+
+using namespace raytracing;
+using namespace raytracing::test;
+
+// A scene under edit: the BVH with the geometry and objects it keeps in step, and the ids still in it.
+struct EditedScene {
+    BVH bvh;
+    std::vector<Geometry> geometry;
+    std::vector<Object> objects;
+    std::set<int> ids;
+
+    void insert(const std::vector<Geometry> &added) {
+        auto new_ids = bvh.insert(geometry, added);
+        objects.resize(geometry.size());
+        ids.insert(new_ids.begin(), new_ids.end());
+    }
+
+    void remove(const std::vector<int> &removed) {
+        bvh.remove(geometry, objects, removed);
+        for (int id : removed) {
+            ids.erase(id);
+        }
+    }
+};
+
+// The edited tree must hold exactly the remaining primitives, link every slot to its parent, keep its incremental SAH
+// cost, and give the hits of brute force to both the scalar and the packet traversal.
+static void check_scene(const EditedScene &scene, std::mt19937 &rng) {
+    auto &bvh = scene.bvh;
+    CHECK(scene.geometry.size() == scene.objects.size());
+    CHECK(bvh.primitive_ids.size() == scene.geometry.size());
+    CHECK(std::set<int>(bvh.primitive_ids.begin(), bvh.primitive_ids.end()) == scene.ids);
+    check_tree(bvh, scene.geometry, true);
+
+    if (!bvh.depth_first && bvh.root != -1) {
+        CHECK(bvh.parents[bvh.root] == -1);
+        std::vector<int> stack = {bvh.root};
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            if (!bvh.nodes[i].is_leaf()) {
+                CHECK(bvh.parents[i + 1] == i && bvh.parents[bvh.nodes[i].offset] == i);
+                stack.push_back(i + 1);
+                stack.push_back(bvh.nodes[i].offset);
+            }
+        }
+        BVH compacted = bvh;
+        compacted.relayout();
+        check_tree(compacted, scene.geometry, true);
+        CHECK(std::abs(compacted.sah_cost() - bvh.sah_cost()) <= 1e-3f * compacted.sah_cost());
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        Ray rays[8];
+        std::pair<OptInsc, const Object *> hits[8];
+        float distances[8];
+        for (int k = 0; k < 8; ++k) {
+            rays[k] = random_ray(rng);
+            distances[k] = std::numeric_limits<float>::infinity();
+        }
+        intersect_packet<8>(bvh, scene.objects, rays, 8, hits, distances);
+        for (int k = 0; k < 8; ++k) {
+            std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+            float max_distance = std::numeric_limits<float>::infinity();
+            bvh.intersect(scene.objects, rays[k], nearest, max_distance);
+            Hit expected = brute_force(scene.geometry, rays[k]);
+            check_same_hit(expected, to_hit(scene.objects, nearest, max_distance));
+            check_same_hit(expected, to_hit(scene.objects, hits[k], distances[k]));
+            CHECK(bvh.occluded(rays[k], 0.5f * expected.t) == false);
+            CHECK(bvh.occluded(rays[k], 2.f * expected.t) == (expected.index != -1));
+        }
+    }
+}
+
+// Random batches of inserts and removals, each checked against brute force. With the default threshold the tree is
+// sometimes rebuilt, a huge threshold keeps every edit in place.
+static void check_edits(float rebuild_threshold, int batch_size) {
+    std::mt19937 rng(37);
+    EditedScene scene;
+    scene.bvh.rebuild_threshold = rebuild_threshold;
+    scene.geometry = random_primitives(rng, 1000);
+    scene.objects.resize(scene.geometry.size());
+    scene.bvh.build(scene.geometry);
+    for (int id = 0; id < 1000; ++id) {
+        scene.ids.insert(id);
+    }
+    check_scene(scene, rng);
+
+    for (int step = 0; step < 30; ++step) {
+        std::uniform_int_distribution<int> count(1, batch_size);
+        if (step % 2 == 0) {
+            scene.insert(random_primitives(rng, count(rng)));
+        } else {
+            std::vector<int> live(scene.ids.begin(), scene.ids.end());
+            std::shuffle(live.begin(), live.end(), rng);
+            live.resize(std::min<int>(live.size(), count(rng)));
+            scene.remove(live);
+        }
+        check_scene(scene, rng);
+    }
+}
+
+TEST(edits_match_brute_force) {
+    check_edits(1.5f, 40);
+    check_edits(1e9f, 40);
+    check_edits(1e9f, 400);
+}
+
+// Removing everything leaves an empty tree that takes inserts again; unknown ids are rejected.
+TEST(edits_empty_the_tree) {
+    std::mt19937 rng(41);
+    EditedScene scene;
+    scene.geometry = random_primitives(rng, 50);
+    scene.objects.resize(scene.geometry.size());
+    scene.bvh.build(scene.geometry);
+    for (int id = 0; id < 50; ++id) {
+        scene.ids.insert(id);
+    }
+    scene.remove(std::vector<int>(scene.ids.begin(), scene.ids.end()));
+    CHECK(scene.bvh.root == -1);
+    check_scene(scene, rng);
+
+    bool threw = false;
+    try {
+        scene.remove({50});
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    for (int i = 0; i < 20; ++i) {
+        scene.insert(random_primitives(rng, 1));
+        check_scene(scene, rng);
+    }
+}
@@ -0,0 +1,88 @@
+#include <algorithm>
+
+#include "test.hpp"
+
+using namespace raytracing;
+using namespace raytracing::test;
+
+static const BuildMethod methods[] = {BuildMethod::Sweep, BuildMethod::Binned, BuildMethod::Linear, BuildMethod::Spatial};
+
+static void check_builders(const std::vector<Geometry> &primitives, int n_rays) {
+    std::vector<Object> objects(primitives.size());
+    for (auto method : methods) {
+        BVH bvh;
+        bvh.method = method;
+        bvh.build(primitives);
+        check_tree(bvh, primitives, method != BuildMethod::Spatial);
+
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> distance(0.f, 30.f);
+        for (int i = 0; i < n_rays; ++i) {
+            Ray r = random_ray(rng);
+            std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+            float max_distance = std::numeric_limits<float>::infinity();
+            bvh.intersect(objects, r, nearest, max_distance);
+            check_same_hit(brute_force(primitives, r), to_hit(objects, nearest, max_distance));
+
+            float t_max = distance(rng);
+            bool expected = std::any_of(primitives.begin(), primitives.end(), [&](auto &obj) { return obj.occluded(r, t_max); });
+            CHECK(bvh.occluded(r, t_max) == expected);
+        }
+    }
+}
+
+TEST(builders_match_brute_force) {
+    std::mt19937 rng(7);
+    check_builders(random_primitives(rng, 3000), 3000);
+}
+
+TEST(builders_handle_small_scenes) {
+    for (int n : {0, 1, 2, 3, 5}) {
+        std::mt19937 rng(n);
+        check_builders(random_primitives(rng, n), 200);
+    }
+}
+
+// All centers coincide, so no split separates the primitives by their centers.
+TEST(builders_handle_equal_centers) {
+    std::mt19937 rng(11);
+    auto primitives = random_primitives(rng, 500);
+    for (auto &obj : primitives) {
+        obj.position = glm::vec3(1.f, 2.f, 3.f);
+        obj.finalize();
+    }
+    check_builders(primitives, 1000);
+}
+
+// Moves every primitive a little, then far, and refits; the tree must stay valid whether or not update() rebuilds it,
+// also right after incremental inserts.
+TEST(refit_matches_brute_force) {
+    for (float rebuild_threshold : {1.5f, 1e9f}) {
+        std::mt19937 rng(71);
+        std::uniform_real_distribution<float> u(-1.f, 1.f);
+        auto primitives = random_primitives(rng, 2000);
+        BVH bvh;
+        bvh.rebuild_threshold = rebuild_threshold;
+        bvh.build(primitives);
+        bvh.insert(primitives, random_primitives(rng, 50));
+        std::vector<Object> objects(primitives.size());
+
+        for (float step : {0.1f, 5.f}) {
+            for (auto &obj : primitives) {
+                obj.position += step * glm::vec3(u(rng), u(rng), u(rng));
+                obj.finalize();
+            }
+            bool rebuilt = bvh.update(primitives);
+            CHECK(bvh.depth_first);
+            CHECK(!rebuilt || rebuild_threshold < 1e9f);
+            check_tree(bvh, primitives, true);
+            for (int i = 0; i < 1000; ++i) {
+                Ray r = random_ray(rng);
+                std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+                float max_distance = std::numeric_limits<float>::infinity();
+                bvh.intersect(objects, r, nearest, max_distance);
+                check_same_hit(brute_force(primitives, r), to_hit(objects, nearest, max_distance));
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#include <algorithm>
+
+#include "grid.hpp"
+#include "test.hpp"
+
+using namespace raytracing;
+using namespace raytracing::test;
+
+static void check_grid(const std::vector<Geometry> &primitives) {
+    std::vector<Object> objects(primitives.size());
+    Grid grid;
+    grid.build(primitives);
+
+    std::mt19937 rng(59);
+    std::uniform_real_distribution<float> distance(0.f, 30.f);
+    for (int i = 0; i < 3000; ++i) {
+        Ray r = random_ray(rng);
+        std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+        float max_distance = std::numeric_limits<float>::infinity();
+        grid.intersect(objects, r, nearest, max_distance);
+        check_same_hit(brute_force(primitives, r), to_hit(objects, nearest, max_distance));
+
+        float t_max = distance(rng);
+        bool expected = std::any_of(primitives.begin(), primitives.end(), [&](auto &obj) { return obj.occluded(r, t_max); });
+        CHECK(grid.occluded(r, t_max) == expected);
+    }
+}
+
+TEST(grid_matches_brute_force) {
+    std::mt19937 rng(61);
+    check_grid(random_primitives(rng, 3000));
+    check_grid(random_primitives(rng, 1));
+    check_grid({});
+}
+
+// Rays along an axis never step along the other two.
+TEST(grid_handles_axis_aligned_rays) {
+    std::mt19937 rng(67);
+    auto primitives = random_primitives(rng, 2000);
+    std::vector<Object> objects(primitives.size());
+    Grid grid;
+    grid.build(primitives);
+    std::uniform_int_distribution<int> coordinate(-12, 12);
+    for (int i = 0; i < 3000; ++i) {
+        glm::vec3 dir(0.f);
+        dir[i % 3] = i % 2 == 0 ? 1.f : -1.f;
+        Ray r = {glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng)), dir};
+        std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+        float max_distance = std::numeric_limits<float>::infinity();
+        grid.intersect(objects, r, nearest, max_distance);
+        check_same_hit(brute_force(primitives, r), to_hit(objects, nearest, max_distance));
+    }
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+
+#include "test.hpp"
+
+namespace raytracing::test {
+
+std::vector<TestCase> &test_cases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+bool register_test(const char *name, void (*run)()) {
+    test_cases().push_back({name, run});
+    return true;
+}
+
+std::vector<Geometry> random_primitives(std::mt19937 &rng, int n, float extent) {
+    std::uniform_real_distribution<float> u(-1.f, 1.f);
+    std::uniform_real_distribution<float> size(0.05f, 0.6f);
+    std::vector<Geometry> primitives(n);
+    for (int i = 0; i < n; ++i) {
+        auto &obj = primitives[i];
+        obj.shape = static_cast<Shape>(1 + i % 3);
+        obj.position = extent * glm::vec3(u(rng), u(rng), u(rng));
+        obj.rotation = glm::normalize(glm::quat(u(rng), u(rng), u(rng), u(rng)));
+        obj.inv_rotation = glm::conjugate(obj.rotation);
+        obj.ellipsoid_radius = {size(rng), size(rng), size(rng)};
+        obj.box_size = {size(rng), size(rng), size(rng)};
+        obj.tri_A = 2.f * glm::vec3(u(rng), u(rng), u(rng));
+        obj.tri_B = 2.f * glm::vec3(u(rng), u(rng), u(rng));
+        obj.tri_C = 2.f * glm::vec3(u(rng), u(rng), u(rng));
+        obj.finalize();
+    }
+    return primitives;
+}
+
+Ray random_ray(std::mt19937 &rng, float extent, const glm::vec3 &center) {
+    std::uniform_real_distribution<float> u(-1.f, 1.f);
+    glm::vec3 dir;
+    do {
+        dir = {u(rng), u(rng), u(rng)};
+    } while (glm::length(dir) < 0.1f);
+    return {center + extent * glm::vec3(u(rng), u(rng), u(rng)), glm::normalize(dir)};
+}
+
+Hit brute_force(const std::vector<Geometry> &primitives, const Ray &r) {
+    Hit hit;
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        auto insc = primitives[i].intersect(r);
+        if (insc && insc->t < hit.t) {
+            hit = {static_cast<int>(i), insc->t};
+        }
+    }
+    return hit;
+}
+
+Hit to_hit(const std::vector<Object> &objects, const std::pair<OptInsc, const Object *> &nearest, float max_distance) {
+    if (nearest.second == nullptr) {
+        return {};
+    }
+    return {static_cast<int>(nearest.second - objects.data()), max_distance};
+}
+
+// Accelerators run the same primitive tests as the reference, so distances match exactly; the index may only differ
+// where two primitives are hit at the same distance. Coplanar primitives are hit a rounding error apart, and which of
+// them a traversal reaches before its box tests cull the rest varies, so those comparisons take a relative tolerance.
+void check_same_hit(const Hit &expected, const Hit &actual, float tolerance) {
+    CHECK((expected.index == -1) == (actual.index == -1));
+    CHECK(expected.index == -1 || std::abs(expected.t - actual.t) <= tolerance * expected.t);
+}
+
+static bool contains(const AABB &outer, const AABB &inner) {
+    return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::greaterThanEqual(outer.max, inner.max));
+}
+
+void check_tree(const BVH &bvh, const std::vector<Geometry> &primitives, bool unique_references) {
+    std::vector<int> seen(primitives.size(), 0);
+    if (bvh.root != -1) {
+        std::vector<int> stack = {bvh.root};
+        int visited = 0;
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            CHECK(i >= 0 && i < static_cast<int>(bvh.nodes.size()));
+            CHECK(++visited <= static_cast<int>(bvh.nodes.size()));
+            auto &node = bvh.nodes[i];
+            if (node.is_leaf()) {
+                CHECK(node.offset >= 0 && node.offset + node.primitive_count <= static_cast<int>(bvh.references.size()));
+                for (uint32_t k = 0; k < node.primitive_count; ++k) {
+                    int index = bvh.references[node.offset + k];
+                    CHECK(index >= 0 && index < static_cast<int>(primitives.size()));
+                    ++seen[index];
+                    // spatial splits clip a reference to the bounds of its leaf
+                    if (unique_references) {
+                        AABB aabb;
+                        aabb.extend(primitives[index]);
+                        CHECK(contains(node.aabb, aabb));
+                    }
+                }
+            } else {
+                CHECK(contains(node.aabb, bvh.nodes[i + 1].aabb));
+                CHECK(contains(node.aabb, bvh.nodes[node.offset].aabb));
+                stack.push_back(i + 1);
+                stack.push_back(node.offset);
+            }
+        }
+    }
+    for (int count : seen) {
+        CHECK(unique_references ? count == 1 : count >= 1);
+    }
+}
+
+TempDirectory::TempDirectory() {
+    auto base = std::filesystem::temp_directory_path();
+    std::random_device device;
+    do {
+        path = (base / ("raytracing_test_" + std::to_string(device()))).string();
+    } while (!std::filesystem::create_directory(path));
+}
+
+TempDirectory::~TempDirectory() {
+    std::error_code error;
+    std::filesystem::remove_all(path, error);
+}
+
+std::string TempDirectory::file(const std::string &name) const { return (std::filesystem::path(path) / name).string(); }
+
+} // namespace raytracing::test
+
+// Runs every test, or those whose name contains the first argument, and returns the number of failures.
+int main(int argc, char **argv) {
+    using namespace raytracing::test;
+    std::string filter = argc > 1 ? argv[1] : "";
+    int n_run = 0;
+    int n_failed = 0;
+    for (auto &test : test_cases()) {
+        if (std::string(test.name).find(filter) == std::string::npos) {
+            continue;
+        }
+        ++n_run;
+        auto begin = std::chrono::steady_clock::now();
+        try {
+            test.run();
+            std::chrono::duration<float> delta = std::chrono::steady_clock::now() - begin;
+            std::cerr << "PASS " << test.name << " (" << delta.count() << "[s])" << std::endl;
+        } catch (const std::exception &e) {
+            ++n_failed;
+            std::cerr << "FAIL " << test.name << ": " << e.what() << std::endl;
+        }
+    }
+    std::cerr << n_run - n_failed << "/" << n_run << " tests passed" << std::endl;
+    return std::min(n_failed, 255);
+}
@@ -0,0 +1,255 @@
+#include <cstring>
+#include <fstream>
+
+#include "mesh.hpp"
+#include "test.hpp"
+
+using namespace raytracing;
+using namespace raytracing::test;
+
+static std::string write_file(const TempDirectory &directory, const std::string &name, const std::string &content) {
+    std::string path = directory.file(name);
+    std::ofstream file(path, std::ios::binary);
+    file.write(content.data(), content.size());
+    return path;
+}
+
+template <typename Loader> static bool throws(Loader load, const std::string &path) {
+    Mesh mesh;
+    try {
+        load(path, mesh);
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+static bool same_vertices(const Mesh &mesh, const std::vector<glm::vec3> &expected) {
+    VertexView view = mesh.positions();
+    if (view.count != expected.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (view[i] != expected[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The mesh's triangles as separate primitives, the reference for its own BVH.
+static void check_mesh_hits(Mesh &mesh) {
+    mesh.build(BVH());
+    std::vector<Geometry> triangles(mesh.triangles.size());
+    VertexView view = mesh.positions();
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        triangles[i].shape = Shape::Triangle;
+        triangles[i].tri_A = view[mesh.triangles[i][0]];
+        triangles[i].tri_B = view[mesh.triangles[i][1]];
+        triangles[i].tri_C = view[mesh.triangles[i][2]];
+        triangles[i].finalize();
+    }
+    std::mt19937 rng(43);
+    for (int i = 0; i < 2000; ++i) {
+        Ray r = random_ray(rng, 3.f);
+        std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+        float max_distance = std::numeric_limits<float>::infinity();
+        mesh.intersect(r, nearest, max_distance);
+        Hit expected = brute_force(triangles, r);
+        CHECK((nearest.second != nullptr) == (expected.index != -1));
+        CHECK(expected.index == -1 || max_distance == expected.t);
+    }
+}
+
+TEST(obj_parses_faces_and_indices) {
+    TempDirectory directory;
+    // comments, texture coordinates, tabs, CRLF line ends, signs and exponents, a quad and a pentagon split into fans,
+    // negative indices and no newline at the end
+    std::string path = write_file(directory, "mesh.obj",
+                                  "# a comment\r\n"
+                                  "mtllib mesh.mtl\n"
+                                  "o mesh\n"
+                                  "v 0 0 0\n"
+                                  "v\t1.0 0 +0.0\r\n"
+                                  "v 1 1e0 0\n"
+                                  "v .0 10e-1 0.\n"
+                                  "vt 0.5 0.5\n"
+                                  "\n"
+                                  "v -1 -2.5E1 3\n"
+                                  "f 1 2 3\n"
+                                  "f 1/1 2/1 3/1 4/1\n"
+                                  "f -5 -4 -3 -2 -1\n"
+                                  "s off\n"
+                                  "f 2 3 5");
+    Mesh mesh;
+    load_obj(path, mesh);
+    CHECK(same_vertices(mesh, {{0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {1.f, 1.f, 0.f}, {0.f, 1.f, 0.f}, {-1.f, -25.f, 3.f}}));
+    std::vector<glm::uvec3> expected = {{0, 1, 2}, {0, 1, 2}, {0, 2, 3}, {0, 1, 2}, {0, 2, 3}, {0, 3, 4}, {1, 2, 4}};
+    CHECK(mesh.triangles == expected);
+    CHECK(mesh.normals.empty());
+}
+
+// A vertex gets the normalized average of the normals its face corners use.
+TEST(obj_averages_corner_normals) {
+    TempDirectory directory;
+    std::string path = write_file(directory, "mesh.obj",
+                                  "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\n"
+                                  "vn 0 0 1\nvn 1 0 0\n"
+                                  "f 1//1 2//1 3//1\n"
+                                  "f 1/1/2 3/1/2 4/1/-1\n");
+    Mesh mesh;
+    load_obj(path, mesh);
+    CHECK(mesh.normals.size() == 4);
+    CHECK(glm::length(mesh.normals[0] - glm::normalize(glm::vec3(1.f, 0.f, 1.f))) < 1e-6f);
+    CHECK(mesh.normals[1] == glm::vec3(0.f, 0.f, 1.f));
+    CHECK(mesh.normals[3] == glm::vec3(1.f, 0.f, 0.f));
+
+    // normals are dropped when any corner has none
+    path = write_file(directory, "partial.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3\n");
+    load_obj(path, mesh);
+    CHECK(mesh.triangles.size() == 1);
+    CHECK(mesh.normals.empty());
+}
+
+TEST(obj_rejects_malformed_files) {
+    TempDirectory directory;
+    auto malformed = [&](const std::string &content) { return throws(load_obj, write_file(directory, "bad.obj", content)); };
+    CHECK(malformed("v 0 0 0\nv 1 0 0\nf 1 2\n"));
+    CHECK(malformed("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n"));
+    CHECK(malformed("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 0 1 2\n"));
+    CHECK(malformed("v 0 0 0\nv 1 0 0\nv 0 1 0\nf -4 1 2\n"));
+    CHECK(malformed("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1//2 2 3\n"));
+    CHECK(malformed("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3x\n"));
+    CHECK(malformed("v 0 0\n"));
+    CHECK(malformed("v 0 0 zero\n"));
+    CHECK(malformed("vn 0 0 1e\n"));
+    CHECK(throws(load_obj, directory.file("missing.obj")));
+
+    Mesh mesh;
+    load_obj(write_file(directory, "empty.obj", ""), mesh);
+    CHECK(mesh.positions().count == 0 && mesh.triangles.empty());
+}
+
+TEST(obj_mesh_matches_brute_force) {
+    TempDirectory directory;
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<float> u(-2.f, 2.f);
+    std::string content;
+    for (int i = 0; i < 300; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            content += "v " + std::to_string(u(rng)) + " " + std::to_string(u(rng)) + " " + std::to_string(u(rng)) + "\n";
+        }
+        content += "f -3 -2 -1\n";
+    }
+    Mesh mesh;
+    load_obj(write_file(directory, "mesh.obj", content), mesh);
+    CHECK(mesh.triangles.size() == 300);
+    check_mesh_hits(mesh);
+}
+
+// The little-endian bytes of the values, for the body of a PLY file.
+template <typename... Ts> static std::string bytes(Ts... values) {
+    std::string data;
+    (data.append(reinterpret_cast<const char *>(&values), sizeof(values)), ...);
+    return data;
+}
+
+static std::string ply_header(const std::string &elements) { return "ply\nformat binary_little_endian 1.0\n" + elements + "end_header\n"; }
+
+TEST(ply_maps_packed_float_vertices) {
+    TempDirectory directory;
+    std::mt19937 rng(53);
+    std::uniform_real_distribution<float> u(-2.f, 2.f);
+    int n = 300;
+    std::string ply = ply_header("comment random triangles\n"
+                                 "element vertex " + std::to_string(3 * n) + "\n"
+                                 "property float x\nproperty float y\nproperty float z\n"
+                                 "property float nx\nproperty float ny\nproperty float nz\n"
+                                 "element face " + std::to_string(n) + "\n"
+                                 "property list uchar int vertex_indices\n");
+    std::vector<glm::vec3> vertices(3 * n);
+    for (auto &v : vertices) {
+        v = {u(rng), u(rng), u(rng)};
+        ply += bytes(v.x, v.y, v.z, 0.f, 1.f, 0.f);
+    }
+    for (int i = 0; i < n; ++i) {
+        ply += bytes(uint8_t(3), 3 * i, 3 * i + 1, 3 * i + 2);
+    }
+
+    Mesh mesh;
+    load_ply(write_file(directory, "mesh.ply", ply), mesh);
+    CHECK(mesh.mapping != nullptr && mesh.vertices.empty());
+    CHECK(same_vertices(mesh, vertices));
+    CHECK(mesh.normals == std::vector<glm::vec3>(3 * n, glm::vec3(0.f, 1.f, 0.f)));
+    CHECK(mesh.triangles.size() == static_cast<size_t>(n) && mesh.triangles[7] == glm::uvec3(21, 22, 23));
+    check_mesh_hits(mesh);
+}
+
+// Double positions are converted, polygons split into fans, and other elements skipped whether their records have a
+// fixed size or not.
+TEST(ply_converts_other_layouts) {
+    TempDirectory directory;
+    std::string ply = ply_header("element vertex 5\n"
+                                 "property uchar red\nproperty double x\nproperty double y\nproperty double z\n"
+                                 "element edge 1\nproperty int vertex1\nproperty int vertex2\n"
+                                 "element face 3\nproperty list uchar int vertex_indices\n"
+                                 "element material 1\nproperty list uchar char name\n");
+    ply += bytes(uint8_t(255), 0.0, 0.0, 0.0) + bytes(uint8_t(255), 1.0, 0.0, 0.0) + bytes(uint8_t(255), 1.0, 1.0, 0.0) +
+           bytes(uint8_t(255), 0.0, 1.0, 0.0) + bytes(uint8_t(255), 0.5, 0.5, -1.25);
+    ply += bytes(0, 1);
+    ply += bytes(uint8_t(3), 0, 1, 4) + bytes(uint8_t(4), 0, 1, 2, 3) + bytes(uint8_t(5), 0, 1, 2, 3, 4);
+    ply += bytes(uint8_t(2), 'a', 'b');
+
+    Mesh mesh;
+    load_ply(write_file(directory, "mesh.ply", ply), mesh);
+    CHECK(mesh.mapping == nullptr);
+    CHECK(same_vertices(mesh, {{0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {1.f, 1.f, 0.f}, {0.f, 1.f, 0.f}, {0.5f, 0.5f, -1.25f}}));
+    CHECK(mesh.normals.empty());
+    std::vector<glm::uvec3> expected = {{0, 1, 4}, {0, 1, 2}, {0, 2, 3}, {0, 1, 2}, {0, 2, 3}, {0, 3, 4}};
+    CHECK(mesh.triangles == expected);
+
+    // list properties in the vertices, 16 bit indices and extra face properties take the record by record path
+    std::string lists = ply_header("element vertex 3\n"
+                                   "property float x\nproperty list uchar float uv\nproperty float y\nproperty float z\n"
+                                   "element face 1\nproperty uchar flags\nproperty list ushort uint16 vertex_indices\n");
+    lists += bytes(1.f, uint8_t(2), 0.f, 0.f, 2.f, 3.f) + bytes(4.f, uint8_t(0), 5.f, 6.f) + bytes(7.f, uint8_t(1), 0.f, 8.f, 9.f);
+    lists += bytes(uint8_t(1), uint16_t(3), uint16_t(2), uint16_t(1), uint16_t(0));
+    load_ply(write_file(directory, "lists.ply", lists), mesh);
+    CHECK(same_vertices(mesh, {{1.f, 2.f, 3.f}, {4.f, 5.f, 6.f}, {7.f, 8.f, 9.f}}));
+    CHECK(mesh.triangles.size() == 1 && mesh.triangles[0] == glm::uvec3(2, 1, 0));
+}
+
+TEST(ply_rejects_malformed_files) {
+    TempDirectory directory;
+    auto malformed = [&](const std::string &content) { return throws(load_ply, write_file(directory, "bad.ply", content)); };
+    std::string vertices = "element vertex 1\nproperty float x\nproperty float y\nproperty float z\n";
+    std::string faces = "element face 1\nproperty list uchar int vertex_indices\n";
+    std::string vertex = bytes(0.f, 0.f, 0.f);
+
+    CHECK(malformed("plx\n"));
+    CHECK(malformed("ply\nformat ascii 1.0\n" + vertices + "end_header\n0 0 0\n"));
+    CHECK(malformed("ply\nformat binary_big_endian 1.0\n" + vertices + "end_header\n" + vertex));
+    CHECK(malformed("ply\nformat binary_little_endian 1.0\n" + vertices));
+    CHECK(malformed("ply\n" + vertices + "end_header\n" + vertex));
+    CHECK(malformed(ply_header("property float x\n" + vertices) + vertex));
+    CHECK(malformed(ply_header("element vertex 1\nproperty half x\n") + bytes(uint16_t(0))));
+    CHECK(malformed(ply_header("element vertex 1\nproperty float x\nproperty float y\n") + bytes(0.f, 0.f)));
+    CHECK(malformed(ply_header("element face 0\nproperty list uchar int vertex_indices\n")));
+    CHECK(malformed(ply_header(vertices) + bytes(0.f, 0.f)));
+    CHECK(malformed(ply_header(vertices + faces) + vertex + bytes(uint8_t(3), 0, 0)));
+    CHECK(malformed(ply_header(vertices + "element face 1\nproperty list float int vertex_indices\n") + vertex + bytes(3.f, 0, 0, 0)));
+    CHECK(malformed(ply_header(vertices + "element face 1\nproperty uchar flags\nproperty list uchar int vertex_indices\n") + vertex +
+                    bytes(uint8_t(0), uint8_t(3), 0, -1, 0)));
+    CHECK(throws(load_ply, directory.file("missing.ply")));
+
+    // indices past the vertices are caught when the mesh is built
+    Mesh mesh;
+    load_ply(write_file(directory, "range.ply", ply_header(vertices + faces) + vertex + bytes(uint8_t(3), 0, 0, 1)), mesh);
+    bool threw = false;
+    try {
+        mesh.build(BVH());
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+}
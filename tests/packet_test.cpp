@@ -0,0 +1,69 @@
+#include "packet.hpp"
+#include "test.hpp"
+
+using namespace raytracing;
+using namespace raytracing::test;
+
+// Compares every lane of packets of n rays with the scalar traversal; lanes start with random distance limits too.
+template <int N> static void check_packets(const std::vector<Geometry> &primitives, bool coherent) {
+    std::vector<Object> objects(primitives.size());
+    BVH bvh;
+    bvh.build(primitives);
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> u(-1.f, 1.f);
+    std::uniform_real_distribution<float> distance(0.f, 30.f);
+    for (int packet = 0; packet < 500; ++packet) {
+        int n = 1 + packet % N;
+        Ray rays[N];
+        glm::vec3 origin = 15.f * glm::vec3(u(rng), u(rng), u(rng));
+        glm::vec3 target = 5.f * glm::vec3(u(rng), u(rng), u(rng));
+        for (int k = 0; k < n; ++k) {
+            rays[k] = coherent ? Ray{origin, glm::normalize(target + 0.5f * glm::vec3(u(rng), u(rng), u(rng)) - origin)} : random_ray(rng);
+        }
+
+        std::pair<OptInsc, const Object *> hits[N];
+        float distances[N];
+        float limits[N];
+        for (int k = 0; k < n; ++k) {
+            hits[k] = {std::nullopt, nullptr};
+            limits[k] = packet % 3 == 0 ? distance(rng) : std::numeric_limits<float>::infinity();
+            distances[k] = limits[k];
+        }
+        intersect_packet<N>(bvh, objects, rays, n, hits, distances);
+
+        for (int k = 0; k < n; ++k) {
+            std::pair<OptInsc, const Object *> nearest(std::nullopt, nullptr);
+            float max_distance = limits[k];
+            bvh.intersect(objects, rays[k], nearest, max_distance);
+            check_same_hit(to_hit(objects, nearest, max_distance), to_hit(objects, hits[k], distances[k]));
+            CHECK(distances[k] == max_distance);
+        }
+    }
+}
+
+TEST(packets_match_scalar_traversal) {
+    std::mt19937 rng(5);
+    auto primitives = random_primitives(rng, 2000);
+    for (bool coherent : {true, false}) {
+        check_packets<4>(primitives, coherent);
+        check_packets<8>(primitives, coherent);
+        check_packets<16>(primitives, coherent);
+    }
+}
+
+// A packet over an empty tree leaves its lanes untouched.
+TEST(packets_handle_empty_tree) {
+    std::vector<Object> objects;
+    BVH bvh;
+    bvh.build(std::vector<Geometry>());
+    std::mt19937 rng(5);
+    Ray rays[4] = {random_ray(rng), random_ray(rng), random_ray(rng), random_ray(rng)};
+    std::pair<OptInsc, const Object *> hits[4];
+    float distances[4] = {1.f, 2.f, 3.f, 4.f};
+    intersect_packet<4>(bvh, objects, rays, 4, hits, distances);
+    for (int k = 0; k < 4; ++k) {
+        CHECK(hits[k].second == nullptr);
+        CHECK(distances[k] == k + 1.f);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "object.hpp"
+
+namespace raytracing::test {
+
+// A test fails by throwing; CHECK reports the failed condition and its line.
+struct TestCase {
+    const char *name;
+    void (*run)();
+};
+
+std::vector<TestCase> &test_cases();
+bool register_test(const char *name, void (*run)());
+
+#define TEST(name)                                                                                                     \
+    static void name();                                                                                                \
+    static const bool name##_registered = raytracing::test::register_test(#name, name);                                \
+    static void name()
+
+#define CHECK(condition)                                                                                               \
+    do {                                                                                                               \
+        if (!(condition)) {                                                                                            \
+            throw std::runtime_error(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " #condition);         \
+        }                                                                                                              \
+    } while (false)
+
+// Finalized boxes, ellipsoids and triangles with random sizes and rotations in [-extent, extent]^3.
+std::vector<Geometry> random_primitives(std::mt19937 &rng, int n, float extent = 10.f);
+Ray random_ray(std::mt19937 &rng, float extent = 12.f, const glm::vec3 &center = glm::vec3(0.f));
+
+// The scalar reference: every primitive is tested with Geometry::intersect, the nearest hit is kept.
+struct Hit {
+    int index = -1;
+    float t = std::numeric_limits<float>::infinity();
+};
+
+Hit brute_force(const std::vector<Geometry> &primitives, const Ray &r);
+Hit to_hit(const std::vector<Object> &objects, const std::pair<OptInsc, const Object *> &nearest, float max_distance);
+void check_same_hit(const Hit &expected, const Hit &actual, float tolerance = 0.f);
+
+// Walks the tree from the root: every node's box contains its children's, every leaf's box its primitives', and every
+// primitive is reached at least once (exactly once unless spatial splits duplicate references).
+void check_tree(const BVH &bvh, const std::vector<Geometry> &primitives, bool unique_references);
+
+// A fresh directory under the system temp directory, removed with everything in it when the TempDirectory goes away.
+struct TempDirectory {
+    std::string path;
+
+    TempDirectory();
+    ~TempDirectory();
+    std::string file(const std::string &name) const;
+};
+
+} // namespace raytracing::test
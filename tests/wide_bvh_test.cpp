@@ -0,0 +1,119 @@
+#include <cmath>
+
+#include "bvh4.hpp"
+#include "bvh8.hpp"
+#include "test.hpp"
+
+using namespace raytracing;
+using namespace raytracing::test;
+
+// Runs rays from around center through a wide tree built from the BVH over the primitives and compares with the binary
+// tree.
+template <typename Wide>
+static void check_wide_hits(const std::vector<Geometry> &primitives,
+                            const BVH &bvh,
+                            const Wide &wide,
+                            const glm::vec3 &center = glm::vec3(0.f),
+                            float extent = 12.f,
+                            float tolerance = 0.f) {
+    std::vector<Object> objects(primitives.size());
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<float> distance(0.f, 30.f);
+    for (int i = 0; i < 3000; ++i) {
+        Ray r = random_ray(rng, extent, center);
+        std::pair<OptInsc, const Object *> expected(std::nullopt, nullptr), actual(std::nullopt, nullptr);
+        float expected_distance = std::numeric_limits<float>::infinity(), actual_distance = expected_distance;
+        bvh.intersect(objects, r, expected, expected_distance);
+        wide.intersect(objects, r, actual, actual_distance);
+        check_same_hit(to_hit(objects, expected, expected_distance), to_hit(objects, actual, actual_distance), tolerance);
+
+        float t_max = distance(rng);
+        CHECK(wide.occluded(r, t_max) == bvh.occluded(r, t_max));
+    }
+}
+
+TEST(bvh4_matches_bvh) {
+    std::mt19937 rng(13);
+    auto primitives = random_primitives(rng, 3000);
+    BVH bvh;
+    bvh.build(primitives);
+    BVH4 bvh4;
+    bvh4.build(bvh);
+    check_wide_hits(primitives, bvh, bvh4);
+}
+
+// Returns the bounds of the primitives below a BVH8 node, after checking that every dequantized child box contains the
+// primitives below that child.
+static AABB check_quantized_bounds(const BVH8 &bvh8, const BVH &bvh, const std::vector<Geometry> &primitives, int i) {
+    auto &node = bvh8.nodes[i];
+    AABB result;
+    for (int k = 0; k < 8; ++k) {
+        if (!(node.child_mask >> k & 1)) {
+            continue;
+        }
+        AABB child;
+        if (node.primitive_counts[k] > 0) {
+            for (int j = 0; j < node.primitive_counts[k]; ++j) {
+                child.extend(primitives[bvh.references[node.children[k] + j]]);
+            }
+        } else {
+            child = check_quantized_bounds(bvh8, bvh, primitives, node.children[k]);
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            float scale = std::ldexp(1.f, node.exponents[axis]);
+            CHECK(node.origin[axis] + node.bounds[axis][k] * scale <= child.min[axis]);
+            CHECK(node.origin[axis] + node.bounds[axis + 3][k] * scale >= child.max[axis]);
+        }
+        result.extend(child);
+    }
+    return result;
+}
+
+static void check_bvh8(const std::vector<Geometry> &primitives, const glm::vec3 &center, float extent, float tolerance = 0.f) {
+    BVH bvh;
+    bvh.build(primitives);
+    BVH8 bvh8;
+    bvh8.build(bvh);
+    if (bvh8.root != -1) {
+        check_quantized_bounds(bvh8, bvh, primitives, bvh8.root);
+    }
+    bool use_avx2 = bvh8.use_avx2;
+    bvh8.use_avx2 = false;
+    check_wide_hits(primitives, bvh, bvh8, center, extent, tolerance);
+    if (use_avx2) {
+        bvh8.use_avx2 = true;
+        check_wide_hits(primitives, bvh, bvh8, center, extent, tolerance);
+    }
+}
+
+TEST(bvh8_bounds_are_conservative) {
+    std::mt19937 rng(17);
+    check_bvh8(random_primitives(rng, 3000), glm::vec3(0.f), 12.f);
+}
+
+// Tiny primitives far from the origin get steps below the precision of the node origins, a flat scene has no extent
+// in z.
+TEST(bvh8_bounds_are_conservative_at_extreme_scales) {
+    std::mt19937 rng(19);
+    auto primitives = random_primitives(rng, 1000);
+    for (auto &obj : primitives) {
+        obj.position = glm::vec3(1000.f) + 1e-3f * obj.position;
+        obj.ellipsoid_radius *= 1e-3f;
+        obj.box_size *= 1e-3f;
+        obj.tri_A *= 1e-3f;
+        obj.tri_B *= 1e-3f;
+        obj.tri_C *= 1e-3f;
+        obj.finalize();
+    }
+    check_bvh8(primitives, glm::vec3(1000.f), 0.012f);
+
+    primitives = random_primitives(rng, 1000);
+    for (auto &obj : primitives) {
+        obj.shape = Shape::Triangle;
+        obj.position.z = 0.f;
+        obj.rotation = obj.inv_rotation = glm::quat(1.f, 0.f, 0.f, 0.f);
+        obj.tri_A.z = obj.tri_B.z = obj.tri_C.z = 0.f;
+        obj.finalize();
+    }
+    check_bvh8(primitives, glm::vec3(0.f), 12.f, 1e-5f);
+}
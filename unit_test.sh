@@ -0,0 +1,3 @@
+#!/usr/bin/env bash
+
+make -j4 test
\ No newline at end of file